@@ -19,6 +19,11 @@
 
 #include "Crc32.h"
 
+// memcpy
+#include <cstring>
+// std::pair
+#include <utility>
+
 #ifndef __LITTLE_ENDIAN
 #define __LITTLE_ENDIAN 1234
 #endif
@@ -534,8 +539,10 @@ uint32_t crc32_16bytes_prefetch(const void* data, size_t length, uint32_t previo
 #endif
 
 
-/// compute CRC32 using the fastest algorithm for large datasets on modern CPUs
-uint32_t crc32_fast(const void* data, size_t length, uint32_t previousCrc32)
+namespace
+{
+/// compute CRC32 using the fastest table-driven algorithm
+uint32_t crc32_lookup(const void* data, size_t length, uint32_t previousCrc32)
 {
 #ifdef CRC32_USE_LOOKUP_TABLE_SLICING_BY_16
     return crc32_16bytes (data, length, previousCrc32);
@@ -551,6 +558,284 @@ uint32_t crc32_fast(const void* data, size_t length, uint32_t previousCrc32)
 }
 
 
+/// compute CRC32 with the lookup tables while copying to destination, one L1-sized block at a time
+uint32_t crc32_lookup_copy(void* destination, const void* data, size_t length, uint32_t previousCrc32)
+{
+    const size_t BlockSize = 4096;
+    uint8_t*       target  = (uint8_t*) destination;
+    const uint8_t* current = (const uint8_t*) data;
+    while (length > 0)
+    {
+        size_t n = length < BlockSize ? length : BlockSize;
+        memcpy(target, current, n);
+        previousCrc32 = crc32_lookup(target, n, previousCrc32);
+        target  += n;
+        current += n;
+        length  -= n;
+    }
+    return previousCrc32;
+}
+} // anonymous namespace
+
+
+#ifdef CRC32_USE_PCLMULQDQ
+#include <immintrin.h>
+
+// folding as described in Intel's "Fast CRC Computation for Generic Polynomials
+// Using PCLMULQDQ Instruction": 128 bits of state x are moved D bits ahead by
+// x.low * (x^(D+32) mod P) ^ x.high * (x^(D-32) mod P), both bit-reflected and
+// shifted left by one; the state starts as the first 16 bytes XOR the crc
+// and is reduced to 32 bits with a Barrett reduction at the end
+namespace
+{
+const uint64_t Fold2048Low = 0x11542778a; // x^2080 mod P(x)
+const uint64_t Fold2048High = 0x1322d1430; // x^2016 mod P(x)
+const uint64_t Fold512Low  = 0x154442bd4; // x^544  mod P(x)
+const uint64_t Fold512High = 0x1c6e41596; // x^480  mod P(x)
+const uint64_t Fold128Low  = 0x1751997d0; // x^160  mod P(x)
+const uint64_t Fold128High = 0x0ccaa009e; // x^96   mod P(x)
+const uint64_t Fold64      = 0x163cd6124; // x^64   mod P(x)
+const uint64_t BarrettPoly = 0x1db710641; // P(x), bit-reflected
+const uint64_t BarrettMu   = 0x1f7011641; // x^64 / P(x), bit-reflected
+
+// the kernels below optionally store every block they load to a destination (Copy = true)
+
+template <bool Copy>
+__attribute__((target("pclmul,sse4.1")))
+inline __m128i load128(uint8_t* target, const uint8_t* current)
+{
+    auto x = _mm_loadu_si128((const __m128i*) current);
+    if (Copy)
+        _mm_storeu_si128((__m128i*) target, x);
+    return x;
+}
+
+__attribute__((target("pclmul,sse4.1")))
+inline __m128i fold128(__m128i x, __m128i data, __m128i k)
+{
+    auto low  = _mm_clmulepi64_si128(x, k, 0x00);
+    auto high = _mm_clmulepi64_si128(x, k, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(low, high), data);
+}
+
+/// fold the remaining 16 byte blocks into x, reduce to 32 bits and process the tail bytewise
+template <bool Copy>
+__attribute__((target("pclmul,sse4.1")))
+uint32_t crc32_pclmul_finish(__m128i x, uint8_t* target, const uint8_t* current, size_t length)
+{
+    auto k = _mm_set_epi64x(Fold128High, Fold128Low);
+    while (length >= 16)
+    {
+        x = fold128(x, load128<Copy>(target, current), k);
+        target  += 16;
+        current += 16;
+        length  -= 16;
+    }
+
+    // 128 => 64 bits
+    x = _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x10), _mm_srli_si128(x, 8));
+
+    // 64 => 32 bits
+    auto mask32 = _mm_setr_epi32(~0, 0, 0, 0);
+    auto t = _mm_clmulepi64_si128(_mm_and_si128(x, mask32), _mm_set_epi64x(0, Fold64), 0x00);
+    x = _mm_xor_si128(_mm_srli_si128(x, 4), t);
+
+    // Barrett reduction
+    k = _mm_set_epi64x(BarrettMu, BarrettPoly);
+    t = _mm_clmulepi64_si128(_mm_and_si128(x, mask32), k, 0x10);
+    t = _mm_clmulepi64_si128(_mm_and_si128(t, mask32), k, 0x00);
+    uint32_t crc = _mm_extract_epi32(_mm_xor_si128(x, t), 1);
+
+    if (Copy)
+        return crc32_lookup_copy(target, current, length, ~crc);
+    return crc32_lookup(current, length, ~crc);
+}
+
+/// PCLMULQDQ kernel, 64 bytes per iteration
+template <bool Copy>
+__attribute__((target("pclmul,sse4.1")))
+uint32_t crc32_pclmul_impl(uint8_t* target, const uint8_t* current, size_t length, uint32_t previousCrc32)
+{
+    if (length < 64)
+    {
+        if (Copy)
+            return crc32_lookup_copy(target, current, length, previousCrc32);
+        return crc32_lookup(current, length, previousCrc32);
+    }
+
+    auto x0 = load128<Copy>(target,      current);
+    auto x1 = load128<Copy>(target + 16, current + 16);
+    auto x2 = load128<Copy>(target + 32, current + 32);
+    auto x3 = load128<Copy>(target + 48, current + 48);
+    x0 = _mm_xor_si128(x0, _mm_cvtsi32_si128(~previousCrc32));
+    target  += 64;
+    current += 64;
+    length  -= 64;
+
+    auto k = _mm_set_epi64x(Fold512High, Fold512Low);
+    while (length >= 64)
+    {
+        x0 = fold128(x0, load128<Copy>(target,      current),      k);
+        x1 = fold128(x1, load128<Copy>(target + 16, current + 16), k);
+        x2 = fold128(x2, load128<Copy>(target + 32, current + 32), k);
+        x3 = fold128(x3, load128<Copy>(target + 48, current + 48), k);
+        target  += 64;
+        current += 64;
+        length  -= 64;
+    }
+
+    k = _mm_set_epi64x(Fold128High, Fold128Low);
+    auto x = fold128(x0, x1, k);
+    x = fold128(x, x2, k);
+    x = fold128(x, x3, k);
+    return crc32_pclmul_finish<Copy>(x, target, current, length);
+}
+
+template <bool Copy>
+__attribute__((target("avx512f,vpclmulqdq")))
+inline __m512i load512(uint8_t* target, const uint8_t* current)
+{
+    auto z = _mm512_loadu_si512(current);
+    if (Copy)
+        _mm512_storeu_si512(target, z);
+    return z;
+}
+
+__attribute__((target("avx512f,vpclmulqdq")))
+inline __m512i fold512(__m512i x, __m512i data, __m512i k)
+{
+    auto low  = _mm512_clmulepi64_epi128(x, k, 0x00);
+    auto high = _mm512_clmulepi64_epi128(x, k, 0x11);
+    return _mm512_ternarylogic_epi64(low, high, data, 0x96); // a ^ b ^ c
+}
+
+/// VPCLMULQDQ kernel, 256 bytes per iteration
+template <bool Copy>
+__attribute__((target("avx512f,vpclmulqdq,pclmul,sse4.1")))
+uint32_t crc32_vpclmul_impl(uint8_t* target, const uint8_t* current, size_t length, uint32_t previousCrc32)
+{
+    if (length < 256)
+        return crc32_pclmul_impl<Copy>(target, current, length, previousCrc32);
+
+    auto z0 = load512<Copy>(target,       current);
+    auto z1 = load512<Copy>(target +  64, current +  64);
+    auto z2 = load512<Copy>(target + 128, current + 128);
+    auto z3 = load512<Copy>(target + 192, current + 192);
+    auto crc = _mm_cvtsi32_si128(~previousCrc32);
+    z0 = _mm512_xor_si512(z0, _mm512_inserti32x4(_mm512_setzero_si512(), crc, 0));
+    target  += 256;
+    current += 256;
+    length  -= 256;
+
+    // neither _mm512_broadcast_i32x4 here nor the unmasked _mm512_extracti32x4_epi32
+    // below: both merge into an undefined vector, which GCC flags (-Wmaybe-uninitialized)
+    auto k = _mm512_set_epi64(Fold2048High, Fold2048Low, Fold2048High, Fold2048Low,
+                              Fold2048High, Fold2048Low, Fold2048High, Fold2048Low);
+    while (length >= 256)
+    {
+        z0 = fold512(z0, load512<Copy>(target,       current),       k);
+        z1 = fold512(z1, load512<Copy>(target +  64, current +  64), k);
+        z2 = fold512(z2, load512<Copy>(target + 128, current + 128), k);
+        z3 = fold512(z3, load512<Copy>(target + 192, current + 192), k);
+        target  += 256;
+        current += 256;
+        length  -= 256;
+    }
+
+    k = _mm512_set_epi64(Fold512High, Fold512Low, Fold512High, Fold512Low,
+                         Fold512High, Fold512Low, Fold512High, Fold512Low);
+    auto z = fold512(z0, z1, k);
+    z = fold512(z, z2, k);
+    z = fold512(z, z3, k);
+    while (length >= 64)
+    {
+        z = fold512(z, load512<Copy>(target, current), k);
+        target  += 64;
+        current += 64;
+        length  -= 64;
+    }
+
+    // four 128 bit lanes => one
+    auto k128 = _mm_set_epi64x(Fold128High, Fold128Low);
+    auto x = fold128(_mm512_maskz_extracti32x4_epi32(0xF, z, 0), _mm512_maskz_extracti32x4_epi32(0xF, z, 1), k128);
+    x = fold128(x, _mm512_maskz_extracti32x4_epi32(0xF, z, 2), k128);
+    x = fold128(x, _mm512_maskz_extracti32x4_epi32(0xF, z, 3), k128);
+    // crc32_pclmul_finish uses legacy SSE encodings, avoid the transition penalty
+    _mm256_zeroupper();
+    return crc32_pclmul_finish<Copy>(x, target, current, length);
+}
+
+__attribute__((target("pclmul,sse4.1")))
+uint32_t crc32_pclmul_copy(void* destination, const void* data, size_t length, uint32_t previousCrc32)
+{
+    return crc32_pclmul_impl<true>((uint8_t*) destination, (const uint8_t*) data, length, previousCrc32);
+}
+
+__attribute__((target("avx512f,vpclmulqdq,pclmul,sse4.1")))
+uint32_t crc32_vpclmul_copy(void* destination, const void* data, size_t length, uint32_t previousCrc32)
+{
+    return crc32_vpclmul_impl<true>((uint8_t*) destination, (const uint8_t*) data, length, previousCrc32);
+}
+} // anonymous namespace
+
+
+/// compute CRC32 (folding with PCLMULQDQ, 64 bytes per iteration)
+__attribute__((target("pclmul,sse4.1")))
+uint32_t crc32_pclmul(const void* data, size_t length, uint32_t previousCrc32)
+{
+    return crc32_pclmul_impl<false>(nullptr, (const uint8_t*) data, length, previousCrc32);
+}
+
+
+/// compute CRC32 (folding with VPCLMULQDQ, 256 bytes per iteration)
+__attribute__((target("avx512f,vpclmulqdq,pclmul,sse4.1")))
+uint32_t crc32_vpclmul(const void* data, size_t length, uint32_t previousCrc32)
+{
+    return crc32_vpclmul_impl<false>(nullptr, (const uint8_t*) data, length, previousCrc32);
+}
+#endif
+
+
+namespace
+{
+typedef uint32_t (*Crc32Function)(const void* data, size_t length, uint32_t previousCrc32);
+typedef uint32_t (*Crc32CopyFunction)(void* destination, const void* data, size_t length, uint32_t previousCrc32);
+
+/// pick the fastest implementations supported by the CPU we are running on
+std::pair<Crc32Function, Crc32CopyFunction> select_crc32()
+{
+#ifdef CRC32_USE_PCLMULQDQ
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("vpclmulqdq"))
+        return { crc32_vpclmul, crc32_vpclmul_copy };
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"))
+        return { crc32_pclmul, crc32_pclmul_copy };
+#endif
+    return { crc32_lookup, crc32_lookup_copy };
+}
+
+const std::pair<Crc32Function, Crc32CopyFunction>& best_crc32()
+{
+    static const auto best = select_crc32();
+    return best;
+}
+} // anonymous namespace
+
+
+/// compute CRC32 using the fastest algorithm for large datasets on modern CPUs
+uint32_t crc32_fast(const void* data, size_t length, uint32_t previousCrc32)
+{
+    return best_crc32().first(data, length, previousCrc32);
+}
+
+
+/// copy length bytes from data to destination and compute their CRC32 in the same pass
+uint32_t crc32_copy(void* destination, const void* data, size_t length, uint32_t previousCrc32)
+{
+    return best_crc32().second(destination, data, length, previousCrc32);
+}
+
+
 /// merge two CRC32 such that result = crc32(dataB, lengthB, crc32(dataA, lengthA))
 uint32_t crc32_combine(uint32_t crcA, uint32_t crcB, size_t lengthB)
 {
@@ -6,6 +6,8 @@
 // see http://create.stephan-brumme.com/disclaimer.html
 //
 
+#pragma once
+
 // if running on an embedded system, you might consider shrinking the
 // big Crc32Lookup table by undefining these lines:
 #define CRC32_USE_LOOKUP_TABLE_BYTE
@@ -22,6 +24,12 @@
 // - crc32_16bytes  needs all of Crc32Lookup
 // using the aforementioned #defines the table is automatically fitted to your needs
 
+// carry-less multiplication kernels (x86 with GCC or Clang); crc32_fast picks
+// them at runtime if the CPU supports them and falls back to the tables otherwise
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CRC32_USE_PCLMULQDQ
+#endif
+
 // uint8_t, uint32_t, int32_t
 #include <stdint.h>
 // size_t
@@ -31,6 +39,9 @@
 /// compute CRC32 using the fastest algorithm for large datasets on modern CPUs
 uint32_t crc32_fast    (const void* data, size_t length, uint32_t previousCrc32 = 0);
 
+/// copy length bytes from data to destination and compute their CRC32 in the same pass
+uint32_t crc32_copy    (void* destination, const void* data, size_t length, uint32_t previousCrc32 = 0);
+
 /// merge two CRC32 such that result = crc32(dataB, lengthB, crc32(dataA, lengthA))
 uint32_t crc32_combine (uint32_t crcA, uint32_t crcB, size_t lengthB);
 
@@ -66,4 +77,11 @@ uint32_t crc32_4x8bytes(const void* data, size_t length, uint32_t previousCrc32
 uint32_t crc32_16bytes (const void* data, size_t length, uint32_t previousCrc32 = 0);
 /// compute CRC32 (Slicing-by-16 algorithm, prefetch upcoming data blocks)
 uint32_t crc32_16bytes_prefetch(const void* data, size_t length, uint32_t previousCrc32 = 0, size_t prefetchAhead = 256);
-#endif
\ No newline at end of file
+#endif
+
+#ifdef CRC32_USE_PCLMULQDQ
+/// compute CRC32 (folding with PCLMULQDQ), the CPU must support PCLMULQDQ and SSE4.1
+uint32_t crc32_pclmul  (const void* data, size_t length, uint32_t previousCrc32 = 0);
+/// compute CRC32 (folding with VPCLMULQDQ), the CPU must support VPCLMULQDQ and AVX-512
+uint32_t crc32_vpclmul (const void* data, size_t length, uint32_t previousCrc32 = 0);
+#endif
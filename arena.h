@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "slice.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+constexpr std::size_t HUGE_PAGE_SIZE = 2 << 20;
+
+/**
+ * Bump allocator over a single block of memory that is allocated once.
+ *
+ * Allocations are released all at once by rewinding to a mark taken
+ * earlier, so state that lives for a block (Huffman tables) is placed after
+ * state that lives for the decoder (window). The memory is not zero-filled.
+ *
+ * With huge_pages, the block is rounded up to 2 MiB, aligned to 2 MiB and
+ * advised to be backed by transparent huge pages (Linux only).
+ */
+class Arena {
+ public:
+  explicit Arena(std::size_t size, bool huge_pages = false)
+      : begin_{nullptr}, size_{size}, cur_{0}, mapped_{false} {
+#ifdef __linux__
+    if (huge_pages) {
+      size_ = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+      // over-allocate so that the block can be aligned to a huge page
+      auto len = size_ + HUGE_PAGE_SIZE;
+      auto ptr = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (ptr != MAP_FAILED) {
+        auto addr = reinterpret_cast<uintptr_t>(ptr);
+        auto aligned = (addr + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        if (aligned > addr) munmap(ptr, aligned - addr);
+        auto tail = addr + len - (aligned + size_);
+        if (tail > 0) munmap(reinterpret_cast<void *>(aligned + size_), tail);
+        begin_ = reinterpret_cast<uint8_t *>(aligned);
+        madvise(begin_, size_, MADV_HUGEPAGE);  // best effort
+        mapped_ = true;
+        return;
+      }
+      size_ = size;
+    }
+#endif
+    begin_ = static_cast<uint8_t *>(
+        ::operator new(size_, std::align_val_t{ALIGNMENT}));
+  }
+
+  Arena(Arena const &) = delete;
+  Arena &operator=(Arena const &) = delete;
+
+  Arena(Arena &&other) noexcept
+      : begin_{other.begin_},
+        size_{other.size_},
+        cur_{other.cur_},
+        mapped_{other.mapped_} {
+    other.begin_ = nullptr;
+  }
+
+  Arena &operator=(Arena &&other) noexcept {
+    std::swap(begin_, other.begin_);
+    std::swap(size_, other.size_);
+    std::swap(cur_, other.cur_);
+    std::swap(mapped_, other.mapped_);
+    return *this;
+  }
+
+  ~Arena() {
+    if (!begin_) return;
+#ifdef __linux__
+    if (mapped_) {
+      munmap(begin_, size_);
+      return;
+    }
+#endif
+    ::operator delete(begin_, std::align_val_t{ALIGNMENT});
+  }
+
+  // n uninitialized objects of trivial type T; throws if the arena is full
+  template <typename T>
+  Slice<T> allocate(std::size_t n) {
+    auto begin = (cur_ + alignof(T) - 1) / alignof(T) * alignof(T);
+    auto end = begin + n * sizeof(T);
+    if (end > size_) throw std::bad_alloc{};
+    cur_ = end;
+    auto ptr = reinterpret_cast<T *>(begin_ + begin);
+    return Slice{ptr, ptr + n};
+  }
+
+  std::size_t mark() const { return cur_; }
+
+  // releases everything allocated after the mark was taken
+  void rewind(std::size_t mark) { cur_ = mark; }
+
+  std::size_t capacity() const { return size_; }
+
+ private:
+  static constexpr std::size_t ALIGNMENT = 64;
+
+  uint8_t *begin_;
+  std::size_t size_, cur_;
+  bool mapped_;
+};
+
+/**
+ * Arenas of one size handed back by their owners for the next ones to
+ * reuse, which saves allocating and faulting in a fresh block: suspended
+ * decoders give theirs back and take one when they resume. At most
+ * max_free are kept; they are not charged to any MemoryBudget.
+ */
+class ArenaPool {
+ public:
+  ArenaPool(std::size_t size, bool huge_pages, std::size_t max_free)
+      : size_{size}, huge_pages_{huge_pages}, max_free_{max_free} {}
+
+  ArenaPool(ArenaPool const &) = delete;
+  ArenaPool &operator=(ArenaPool const &) = delete;
+
+  // rewound to its start
+  Arena take() {
+    {
+      std::lock_guard lock{lock_};
+      if (!free_.empty()) {
+        auto arena = std::move(free_.back());
+        free_.pop_back();
+        arena.rewind(0);
+        return arena;
+      }
+    }
+    return Arena{size_, huge_pages_};
+  }
+
+  // freed instead if max_free are kept already
+  void give(Arena arena) {
+    std::lock_guard lock{lock_};
+    if (free_.size() < max_free_) free_.push_back(std::move(arena));
+  }
+
+ private:
+  std::size_t size_;
+  bool huge_pages_;
+  std::size_t max_free_;
+  std::mutex lock_;
+  std::vector<Arena> free_;
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+// C++20 only; the rest of the library builds as C++17 without it
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "push.h"
+
+/**
+ * Lazily started coroutine returning a T. Awaiting it runs it on the
+ * awaiting thread, and it resumes the awaiter directly when it is done, so
+ * it works with any executor that resumes the input's awaitables.
+ */
+template <typename T>
+class Task {
+ public:
+  struct promise_type {
+    std::optional<T> value;
+    std::exception_ptr error;
+    std::coroutine_handle<> continuation;
+
+    Task get_return_object() {
+      return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    auto final_suspend() noexcept {
+      struct Resume {
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(
+            std::coroutine_handle<promise_type> handle) noexcept {
+          auto continuation = handle.promise().continuation;
+          return continuation ? continuation : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+      };
+      return Resume{};
+    }
+
+    void return_value(T x) { value = std::move(x); }
+
+    void unhandled_exception() { error = std::current_exception(); }
+  };
+
+  Task(Task &&other) noexcept : handle_{std::exchange(other.handle_, {})} {}
+
+  Task(Task const &) = delete;
+  Task &operator=(Task const &) = delete;
+
+  ~Task() {
+    if (handle_) handle_.destroy();
+  }
+
+  bool await_ready() const noexcept { return false; }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) {
+    handle_.promise().continuation = awaiter;
+    return handle_;
+  }
+
+  T await_resume() {
+    auto &promise = handle_.promise();
+    if (promise.error) std::rethrow_exception(promise.error);
+    return std::move(*promise.value);
+  }
+
+ private:
+  explicit Task(std::coroutine_handle<promise_type> handle) : handle_{handle} {}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+/**
+ * Decompressor for coroutines: the input is read with
+ * co_await source.read(buf), which returns the number of bytes read, 0 at
+ * the end, like a Read. While it waits, the decoder is suspended with the
+ * coroutine; the PushDecompressor under it keeps the state, so no thread
+ * is tied up.
+ *
+ *   auto n = co_await decompressor.read_some(buf);
+ */
+template <typename Source>
+class AsyncDecompressor {
+ public:
+  explicit AsyncDecompressor(Source &source, std::size_t input_size = 64 << 10,
+                             MemoryBudget *budget = nullptr)
+      : source_{source},
+        decompressor_{budget},
+        input_(input_size),
+        fed_{false},
+        eof_{false} {}
+
+  // returns as soon as some output is available; 0 at the end
+  Task<std::size_t> read_some(Slice<uint8_t> buf) {
+    for (;;) {
+      auto result = decompressor_.drain(buf);
+      if (result.n > 0) co_return result.n;
+      if (eof_) {
+        if (result.status == PushStatus::Done) co_return 0;
+        throw Error{fed_ ? ErrorType::UnexpectedEof : ErrorType::EmptyInput};
+      }
+      auto n = co_await source_.read(Slice{input_});
+      if (n == 0) {
+        eof_ = true;
+      } else {
+        decompressor_.feed(Slice{input_.data(), input_.data() + n});
+        fed_ = true;
+      }
+    }
+  }
+
+  // fills buf unless the end comes first
+  Task<std::size_t> read(Slice<uint8_t> buf) {
+    std::size_t n = 0;
+    while (n < buf.size()) {
+      auto len = co_await read_some(Slice{buf.begin() + n, buf.end()});
+      if (len == 0) break;
+      n += len;
+    }
+    co_return n;
+  }
+
+ private:
+  Source &source_;
+  PushDecompressor decompressor_;
+  std::vector<uint8_t> input_;
+  bool fed_, eof_;
+};
+
+#endif
@@ -0,0 +1,297 @@
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <thread>
+
+#include <unistd.h>
+
+#include "decompressor.h"
+#include "io.h"
+#include "pool.h"
+#include "push.h"
+#ifdef USE_FAST_CRC32
+#include "Crc32.h"
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+int usage(std::string const& program) {
+  std::cerr << "usage: " << program << " <benchmark> [args]\n";
+  std::cerr << "\tlatency FILE [N]: decompresses the in-memory FILE N times "
+               "with a new and with a reset decompressor\n";
+  std::cerr << "\ttrickle FILE [PIECE] [INTERVAL_US]: feeds FILE through a "
+               "pipe PIECE bytes at a time and reports how far the output "
+               "lags behind, with and without streaming\n";
+  std::cerr << "\tpush FILE [PIECE]: decompresses the in-memory FILE fed "
+               "PIECE bytes at a time to a push decoder, against pulling "
+               "it\n";
+  std::cerr << "\tpool FILE [STREAMS] [WORKERS]: decompresses FILE as "
+               "STREAMS streams fed 4 KiB at a time in turn, on a pool of "
+               "WORKERS threads\n";
+#ifdef USE_FAST_CRC32
+  std::cerr << "\tcrc: CRC32 throughput of each implementation across buffer "
+               "sizes\n";
+#endif
+  std::cerr << "\tExample: " << program << " latency 1k.gz\n";
+  return -1;
+}
+
+std::vector<uint8_t> read_file(const char* path) {
+  std::ifstream file{path, std::ios::binary};
+  if (!file) throw Error{ErrorType::StdIoError};
+  return {std::istreambuf_iterator<char>{file},
+          std::istreambuf_iterator<char>{}};
+}
+
+void report(const char* name, Clock::duration elapsed, std::size_t n) {
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+  std::cout << name << ": " << ns.count() / n << " ns/op\n";
+}
+
+template <typename Read>
+std::size_t drain(Decompressor<Read>& decompressor, Slice<uint8_t> buf) {
+  std::size_t total = 0;
+  for (;;) {
+    auto n = decompressor.read(buf);
+    total += n;
+    if (n < buf.size()) return total;
+  }
+}
+
+int bench_latency(std::vector<uint8_t> const& input, std::size_t iterations) {
+  std::vector<uint8_t> output(64 << 10);
+  Slice buf{output};
+  auto begin = input.data();
+  auto end = input.data() + input.size();
+
+  auto start = Clock::now();
+  for (std::size_t i = 0; i < iterations; ++i) {
+    MemoryReader reader{begin, end};
+    Decompressor decompressor{reader, false};
+    drain(decompressor, buf);
+  }
+  report("new decompressor", Clock::now() - start, iterations);
+
+  MemoryReader reader{begin, end};
+  Decompressor decompressor{reader, false};
+  start = Clock::now();
+  for (std::size_t i = 0; i < iterations; ++i) {
+    reader = MemoryReader{begin, end};
+    decompressor.reset(reader);
+    drain(decompressor, buf);
+  }
+  report("reset decompressor", Clock::now() - start, iterations);
+  return 0;
+}
+
+// output lag while the input arrives in pieces: for each piece, the time
+// until the next output after it was sent
+void trickle(std::vector<uint8_t> const& input, std::size_t piece,
+             std::chrono::microseconds interval, bool streaming) {
+  int fds[2];
+  if (pipe(fds) != 0) throw Error{ErrorType::StdIoError};
+  std::vector<Clock::time_point> sent;
+  sent.reserve(input.size() / piece + 1);
+  std::thread writer{[&] {
+    for (std::size_t i = 0; i < input.size(); i += piece) {
+      sent.push_back(Clock::now());
+      auto n = std::min(piece, input.size() - i);
+      if (write(fds[1], &input[i], n) != static_cast<ssize_t>(n)) break;
+      std::this_thread::sleep_for(interval);
+    }
+    close(fds[1]);
+  }};
+
+  std::vector<Clock::time_point> received;
+  {
+    FdReader reader{fds[0]};
+    Decompressor decompressor{reader, false};
+    std::vector<uint8_t> output(64 << 10);
+    Slice buf{output};
+    if (streaming) {
+      decompressor.stream();
+      while (decompressor.read_some(buf) != 0) received.push_back(Clock::now());
+    } else {
+      for (;;) {
+        auto n = decompressor.read(buf);
+        received.push_back(Clock::now());
+        if (n < buf.size()) break;
+      }
+    }
+  }
+  writer.join();
+  close(fds[0]);
+
+  double total = 0;
+  std::size_t j = 0;
+  for (auto t : sent) {
+    while (j < received.size() && received[j] < t) ++j;
+    if (j == received.size()) break;
+    total += std::chrono::duration<double, std::milli>(received[j] - t).count();
+  }
+  std::cout << (streaming ? "streaming" : "buffered") << ": "
+            << received.size() << " outputs, mean lag "
+            << total / sent.size() << " ms\n";
+}
+
+int bench_trickle(std::vector<uint8_t> const& input, std::size_t piece,
+                  std::chrono::microseconds interval) {
+  trickle(input, piece, interval, false);
+  trickle(input, piece, interval, true);
+  return 0;
+}
+
+int bench_push(std::vector<uint8_t> const& input, std::size_t piece) {
+  std::vector<uint8_t> output(64 << 10);
+  Slice buf{output};
+
+  auto start = Clock::now();
+  MemoryReader reader{input.data(), input.data() + input.size()};
+  Decompressor decompressor{reader, false};
+  auto pulled = drain(decompressor, buf);
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  std::cout << "pull: " << pulled / elapsed.count() / 1e6 << " MB/s\n";
+
+  start = Clock::now();
+  PushDecompressor push;
+  std::size_t pushed = 0;
+  for (std::size_t i = 0; i < input.size(); i += piece) {
+    auto end = input.data() + std::min(i + piece, input.size());
+    push.feed(Slice{&input[i], end});
+    for (;;) {
+      auto result = push.drain(buf);
+      pushed += result.n;
+      if (result.status != PushStatus::HasOutput) break;
+    }
+  }
+  elapsed = Clock::now() - start;
+  std::cout << "push: " << pushed / elapsed.count() / 1e6 << " MB/s\n";
+  if (pushed != pulled) throw Error{ErrorType::SizeMismatch};
+  return 0;
+}
+
+int bench_pool(std::vector<uint8_t> const& input, std::size_t streams,
+               std::size_t workers) {
+  constexpr std::size_t PIECE = 4096;
+  std::mutex lock;
+  std::vector<Clock::duration> first_output(streams);
+  std::size_t output = 0;
+  std::exception_ptr failure;
+
+  auto start = Clock::now();
+  DecompressorPool pool{workers};
+  std::vector<DecompressorPool::Id> ids;
+  for (std::size_t i = 0; i < streams; ++i) {
+    ids.push_back(pool.open(
+        [&, i](Slice<uint8_t> buf) {
+          std::lock_guard guard{lock};
+          if (first_output[i] == Clock::duration{}) {
+            first_output[i] = Clock::now() - start;
+          }
+          output += buf.size();
+        },
+        [&](std::exception_ptr error) {
+          std::lock_guard guard{lock};
+          if (error && !failure) failure = error;
+        }));
+  }
+  // every stream gets a piece in turn, as from many connections
+  for (std::size_t i = 0; i < input.size(); i += PIECE) {
+    auto end = input.data() + std::min(i + PIECE, input.size());
+    for (auto id : ids) {
+      pool.feed(id, Slice{&input[i], end});
+    }
+  }
+  for (auto id : ids) pool.close(id);
+  pool.wait();
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+
+  std::chrono::duration<double, std::milli> worst{0};
+  for (auto t : first_output) worst = std::max<decltype(worst)>(worst, t);
+  std::cout << streams << " streams on " << workers << " workers: "
+            << output / elapsed.count() / 1e6 << " MB/s, first output after "
+            << worst.count() << " ms at worst\n";
+  if (failure) std::rethrow_exception(failure);
+  return 0;
+}
+
+#ifdef USE_FAST_CRC32
+int bench_crc() {
+  using Crc32Function = uint32_t (*)(const void*, size_t, uint32_t);
+  std::vector<std::pair<const char*, Crc32Function>> functions{
+      {"slicing-by-16", crc32_16bytes}};
+#ifdef CRC32_USE_PCLMULQDQ
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("pclmul")) {
+    functions.emplace_back("pclmulqdq", crc32_pclmul);
+  }
+  if (__builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("vpclmulqdq")) {
+    functions.emplace_back("vpclmulqdq", crc32_vpclmul);
+  }
+#endif
+  functions.emplace_back("fast", crc32_fast);
+
+  constexpr std::size_t TOTAL = 256 << 20;  // bytes hashed per measurement
+  std::vector<uint8_t> data(16 << 20);
+  for (std::size_t i = 0; i < data.size(); ++i) data[i] = i * 2654435761u >> 24;
+
+  // the results are compared, which also keeps them from being elided
+  auto mismatch = false;
+  for (std::size_t size = 64; size <= data.size(); size *= 4) {
+    std::cout << size << " bytes:";
+    uint32_t expected = 0;
+    for (auto [name, function] : functions) {
+      uint32_t crc = 0;
+      auto start = Clock::now();
+      for (std::size_t done = 0; done < TOTAL; done += size) {
+        crc = function(&data[0], size, crc);
+      }
+      std::chrono::duration<double> elapsed = Clock::now() - start;
+      if (function == functions.front().second) expected = crc;
+      std::cout << " " << name << " " << TOTAL / elapsed.count() / 1e9
+                << " GB/s";
+      if (crc != expected) {
+        std::cout << " (wrong CRC)";
+        mismatch = true;
+      }
+    }
+    std::cout << "\n";
+  }
+  return mismatch ? 1 : 0;
+}
+#endif
+
+int main(int argc, const char** argv) {
+  if (argc >= 3 && std::strcmp("latency", argv[1]) == 0) {
+    auto iterations = argc >= 4 ? std::strtoull(argv[3], nullptr, 10) : 100000;
+    if (iterations == 0) return usage(argv[0]);
+    return bench_latency(read_file(argv[2]), iterations);
+  }
+  if (argc >= 3 && std::strcmp("trickle", argv[1]) == 0) {
+    auto piece = argc >= 4 ? std::strtoull(argv[3], nullptr, 10) : 4096;
+    auto interval = argc >= 5 ? std::strtoull(argv[4], nullptr, 10) : 1000;
+    if (piece == 0) return usage(argv[0]);
+    return bench_trickle(read_file(argv[2]), piece,
+                         std::chrono::microseconds{interval});
+  }
+  if (argc >= 3 && std::strcmp("push", argv[1]) == 0) {
+    auto piece = argc >= 4 ? std::strtoull(argv[3], nullptr, 10) : 4096;
+    if (piece == 0) return usage(argv[0]);
+    return bench_push(read_file(argv[2]), piece);
+  }
+  if (argc >= 3 && std::strcmp("pool", argv[1]) == 0) {
+    auto streams = argc >= 4 ? std::strtoull(argv[3], nullptr, 10) : 1000;
+    auto workers = argc >= 5 ? std::strtoull(argv[4], nullptr, 10)
+                             : std::thread::hardware_concurrency();
+    if (streams == 0 || workers == 0) return usage(argv[0]);
+    return bench_pool(read_file(argv[2]), streams, workers);
+  }
+#ifdef USE_FAST_CRC32
+  if (argc == 2 && std::strcmp("crc", argv[1]) == 0) return bench_crc();
+#endif
+  return usage(argv[0]);
+}
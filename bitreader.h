@@ -3,21 +3,66 @@
 #include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "io.h"
 
+// whether Read can hand over its input in place with view()
+template <typename Read, typename = void>
+struct has_view : std::false_type {};
+
+template <typename Read>
+struct has_view<Read, std::void_t<decltype(std::declval<Read &>().view())>>
+    : std::true_type {};
+
+/**
+ * Reads bits out of a buffer that is refilled from the reader. If the reader
+ * holds its input in memory (has_view), the bits are read from there
+ * directly; only the last few bytes are copied into the buffer so that
+ * peek_bits() never reads past the end.
+ */
 template <typename Read>
 class BitReader {
  public:
   explicit BitReader(Read &reader)
-      : reader_{reader}, buf_(BUFFER_SIZE), nbits_{0}, begin_{0}, cap_{0} {}
+      : reader_{&reader},
+        buf_(BUFFER_SIZE),
+        data_{buf_.data()},
+        in_place_{false},
+        nbits_{0},
+        begin_{0},
+        cap_{0},
+        offset_{0} {}
 
-  uint32_t peek_bits() {
-    while (cap_ - begin_ < sizeof(uint32_t)) {
-      if (fill_buf() == 0) throw Error{ErrorType::UnexpectedEof};
-    }
-    auto bits = reinterpret_cast<uint32_t *>(&buf_[begin_]);
+  // starts over on a new input, keeping the buffer
+  void reset(Read &reader) noexcept {
+    reader_ = &reader;
+    data_ = buf_.data();
+    in_place_ = false;
+    nbits_ = 0;
+    begin_ = cap_ = 0;
+    offset_ = 0;
+  }
+
+  // input offset and bits already consumed of the byte there
+  std::pair<uint64_t, uint32_t> position() const noexcept {
+    return {offset_ - (cap_ - begin_), nbits_};
+  }
+
+  // continues at a position(); the reader must be at that byte
+  void seek(uint64_t offset, uint32_t nbits) noexcept {
+    data_ = buf_.data();
+    in_place_ = false;
+    begin_ = cap_ = 0;
+    offset_ = offset;
+    nbits_ = nbits;
+  }
+
+  __attribute__((always_inline)) uint32_t peek_bits() {
+    if (cap_ - begin_ < sizeof(uint32_t)) refill();
+    auto bits = reinterpret_cast<const uint32_t *>(&data_[begin_]);
     return (*bits) >> nbits_;
   }
 
@@ -28,44 +73,88 @@ class BitReader {
     nbits_ %= 8;
   }
 
-  void byte_align() noexcept {
+  void byte_align() {
     if (nbits_ > 0) {
+      // after seek(), the partly consumed byte may not have been read yet
+      if (begin_ == cap_ && fill_buf() == 0) {
+        throw Error{ErrorType::UnexpectedEof};
+      }
       nbits_ = 0;
       ++begin_;
     }
   }
 
-  uint32_t read_bits(uint32_t n) {
+  __attribute__((always_inline)) uint32_t read_bits(uint32_t n) {
     assert(n <= 24);
     auto bits = peek_bits();
     consume(n);
     return bits & ((1 << n) - 1);
   }
 
+  // keeps only the unread bytes until resume()
+  void suspend() {
+    if (in_place_) {
+      buf_ = std::vector<uint8_t>{};
+      return;
+    }
+    std::vector<uint8_t> unread(&buf_[begin_], &buf_[cap_]);
+    buf_.swap(unread);
+    data_ = buf_.data();
+    cap_ -= begin_;
+    begin_ = 0;
+  }
+
+  void resume() {
+    buf_.resize(BUFFER_SIZE);
+    if (!in_place_) data_ = buf_.data();
+  }
+
+  std::size_t capacity() const noexcept { return buf_.size(); }
+
+  // bytes that can be consumed without reading
+  std::size_t buffered() const noexcept { return cap_ - begin_; }
+
   bool has_data_left() { return cap_ > begin_ || fill_buf() != 0; }
 
   std::size_t read(Slice<uint8_t> buf) {
     byte_align();
     auto len = std::min(buf.size(), cap_ - begin_);
-    std::copy(&buf_[begin_], &buf_[begin_ + len], buf.begin());
+    std::copy(&data_[begin_], &data_[begin_ + len], buf.begin());
     begin_ += len;
 
-    len += reader_.read(Slice{buf.begin() + len, buf.end()});
+    while (len < buf.size()) {
+      auto n = reader_->read(Slice{buf.begin() + len, buf.end()});
+      if (n == 0) break;
+      len += n;
+      offset_ += n;
+    }
     return len;
   }
 
+  // up to n bytes of the input without copying them; the view is valid
+  // until the next call
+  Slice<uint8_t> read_view(std::size_t n) {
+    byte_align();
+    if (begin_ == cap_) fill_buf();
+    auto begin = &data_[begin_];
+    auto len = std::min(n, cap_ - begin_);
+    begin_ += len;
+    return Slice{begin, begin + len};
+  }
+
   std::size_t read_until(uint8_t byte, std::vector<uint8_t> &buf) {
     byte_align();
     std::size_t n = 0;
     for (;;) {
-      auto it = std::find(&buf_[begin_], &buf_[cap_], byte);
-      if (it == &buf_[cap_]) {
-        buf.insert(buf.end(), &buf_[begin_], &buf_[cap_]);
+      auto it = std::find(&data_[begin_], &data_[cap_], byte);
+      if (it == &data_[cap_]) {
+        buf.insert(buf.end(), &data_[begin_], &data_[cap_]);
         n += cap_ - begin_;
+        begin_ = cap_;
         if (fill_buf() == 0) return n;
       } else {
-        buf.insert(buf.end(), &buf_[begin_], it + 1);
-        auto pos = it - &buf_[begin_];
+        buf.insert(buf.end(), &data_[begin_], it + 1);
+        auto pos = it - &data_[begin_];
         n += pos + 1;
         begin_ += pos + 1;
         return n;
@@ -74,20 +163,47 @@ class BitReader {
   }
 
  private:
-  Read &reader_;
+  Read *reader_;
   std::vector<uint8_t> buf_;
+  uint8_t *data_;   // buf_, or the reader's memory if in_place_
+  bool in_place_;
   uint32_t nbits_;
   std::size_t begin_, cap_;
+  uint64_t offset_;  // of the end of the data, in the input
   static constexpr std::size_t BUFFER_SIZE = 16 << 10;
 
   std::size_t bit_len() const noexcept { return (cap_ - begin_) * 8 - nbits_; }
 
+  // out of line so that peek_bits() stays small enough to inline
+  __attribute__((noinline)) void refill() {
+    while (cap_ - begin_ < sizeof(uint32_t)) {
+      if (fill_buf() == 0) throw Error{ErrorType::UnexpectedEof};
+    }
+  }
+
   std::size_t fill_buf() {
-    std::memmove(&buf_[0], &buf_[begin_], cap_ - begin_);
+    if constexpr (has_view<Read>::value) {
+      if (begin_ == cap_) {
+        auto view = reader_->view();
+        if (!view.empty()) {
+          data_ = view.begin();
+          in_place_ = true;
+          begin_ = 0;
+          cap_ = view.size();
+          offset_ += cap_;
+          return cap_;
+        }
+      }
+    }
+    // the unread tail is at most a few bytes if it is in the reader's memory
+    std::memmove(&buf_[0], &data_[begin_], cap_ - begin_);
+    data_ = buf_.data();
+    in_place_ = false;
     cap_ -= begin_;
     begin_ = 0;
-    auto n = reader_.read(Slice{&buf_[cap_], &buf_[buf_.size()]});
+    auto n = reader_->read(Slice{&buf_[cap_], &buf_[buf_.size()]});
     cap_ += n;
+    offset_ += n;
     return n;
   }
 };
@@ -27,30 +27,34 @@ class Channel : public Iterator<T> {
   Channel& operator=(Channel&) = delete;
   Channel& operator=(Channel&&) = default;
 
-  bool send(T item) {
+  bool send(T item) { return send_batch(Slice{&item, &item + 1}); }
+
+  // moves all items into the queue under a single lock
+  bool send_batch(Slice<T> items) {
     do {
       if (!is_sender || !state) break;
       std::lock_guard lock{state->lock};
       if (state->closed) break;
-      state->queue.push(std::move(item));
+      for (auto& item : items) state->queue.push(std::move(item));
       state->cv.notify_one();
       return true;
     } while (false);
     return false;
   }
 
-  std::optional<T> next() override {
+  std::size_t next_batch(Slice<T> items) override {
+    std::size_t n = 0;
     do {
-      if (is_sender || !state) break;
+      if (is_sender || !state || items.empty()) break;
       std::unique_lock lock{state->lock};
       state->cv.wait(lock,
                      [this] { return !state->queue.empty() || state->closed; });
-      if (state->queue.empty()) break;
-      auto x = std::move(state->queue.front());
-      state->queue.pop();
-      return x;
+      while (n < items.size() && !state->queue.empty()) {
+        items[n++] = std::move(state->queue.front());
+        state->queue.pop();
+      }
     } while (false);
-    return std::nullopt;
+    return n;
   }
 
   bool close() {
@@ -65,6 +69,12 @@ class Channel : public Iterator<T> {
     return false;
   }
 
+  bool is_closed() const {
+    if (!state) return true;
+    std::lock_guard lock{state->lock};
+    return state->closed;
+  }
+
   ~Channel() { close(); }
 
  private:
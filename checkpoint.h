@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "error.h"
+
+// the input a checkpoint was taken on, so that it is not applied to another
+struct InputStamp {
+  uint64_t size;
+  int64_t mtime;  // in ns
+
+  bool operator==(InputStamp const &other) const {
+    return size == other.size && mtime == other.mtime;
+  }
+  bool operator!=(InputStamp const &other) const { return !(*this == other); }
+};
+
+inline InputStamp stamp_input(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) throw Error{ErrorType::StdIoError};
+#ifdef __APPLE__
+  auto mtime = st.st_mtimespec;
+#else
+  auto mtime = st.st_mtim;
+#endif
+  return {static_cast<uint64_t>(st.st_size),
+          static_cast<int64_t>(mtime.tv_sec) * 1000000000 + mtime.tv_nsec};
+}
+
+/**
+ * Everything a new process needs to continue decoding where a checkpoint
+ * was taken: the position in the input, the decoder state between two
+ * items and the checksum of the current member so far.
+ */
+struct Checkpoint {
+  uint64_t input_offset;
+  uint32_t input_bits;  // already consumed of the byte at input_offset
+  uint32_t state;       // of the Producer
+  uint64_t member_idx;
+  uint32_t hlit, hdist;  // hlit is 0 for the fixed codes
+  std::vector<uint8_t> code_lengths;
+  std::vector<uint8_t> window;  // live history
+  uint32_t crc32, size;
+  uint64_t members;
+  uint64_t output_offset;  // set by the caller
+  InputStamp input;        // set by the caller
+};
+
+namespace checkpoint_detail {
+
+constexpr char MAGIC[8] = {'G', 'Z', 'C', 'K', 'P', 'T', '0', '2'};
+
+template <typename T>
+void put(std::vector<uint8_t> &buf, T x) {
+  auto begin = reinterpret_cast<const uint8_t *>(&x);
+  buf.insert(buf.end(), begin, begin + sizeof(T));
+}
+
+template <typename T>
+T get(const uint8_t *&ptr, const uint8_t *end) {
+  if (end - ptr < static_cast<std::ptrdiff_t>(sizeof(T))) {
+    throw Error{ErrorType::InvalidCheckpoint};
+  }
+  T x;
+  std::memcpy(&x, ptr, sizeof(T));
+  ptr += sizeof(T);
+  return x;
+}
+
+inline void put_bytes(std::vector<uint8_t> &buf,
+                      std::vector<uint8_t> const &xs) {
+  put<uint64_t>(buf, xs.size());
+  buf.insert(buf.end(), xs.begin(), xs.end());
+}
+
+inline std::vector<uint8_t> get_bytes(const uint8_t *&ptr,
+                                      const uint8_t *end) {
+  auto n = get<uint64_t>(ptr, end);
+  if (static_cast<uint64_t>(end - ptr) < n) {
+    throw Error{ErrorType::InvalidCheckpoint};
+  }
+  std::vector<uint8_t> xs(ptr, ptr + n);
+  ptr += n;
+  return xs;
+}
+
+}  // namespace checkpoint_detail
+
+// replaces path only once the new checkpoint is on disk, so that a crash
+// leaves the previous one intact
+inline void save_checkpoint(Checkpoint const &checkpoint,
+                            std::string const &path) {
+  using namespace checkpoint_detail;
+  std::vector<uint8_t> buf(std::begin(MAGIC), std::end(MAGIC));
+  put(buf, checkpoint.input_offset);
+  put(buf, checkpoint.input_bits);
+  put(buf, checkpoint.state);
+  put(buf, checkpoint.member_idx);
+  put(buf, checkpoint.hlit);
+  put(buf, checkpoint.hdist);
+  put_bytes(buf, checkpoint.code_lengths);
+  put_bytes(buf, checkpoint.window);
+  put(buf, checkpoint.crc32);
+  put(buf, checkpoint.size);
+  put(buf, checkpoint.members);
+  put(buf, checkpoint.output_offset);
+  put(buf, checkpoint.input.size);
+  put(buf, checkpoint.input.mtime);
+
+  auto tmp = path + ".tmp";
+  auto fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) throw Error{ErrorType::StdIoError};
+  auto ok = write(fd, buf.data(), buf.size()) ==
+                static_cast<ssize_t>(buf.size()) &&
+            fsync(fd) == 0;
+  ok = close(fd) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    throw Error{ErrorType::StdIoError};
+  }
+}
+
+// nullopt if there is no checkpoint at path
+inline std::optional<Checkpoint> load_checkpoint(std::string const &path) {
+  using namespace checkpoint_detail;
+  auto fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    if (errno == ENOENT) return std::nullopt;
+    throw Error{ErrorType::StdIoError};
+  }
+  std::vector<uint8_t> buf;
+  uint8_t chunk[4096];
+  ssize_t n;
+  while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+    buf.insert(buf.end(), chunk, chunk + n);
+  }
+  close(fd);
+  if (n < 0) throw Error{ErrorType::StdIoError};
+
+  const uint8_t *ptr = buf.data();
+  auto end = buf.data() + buf.size();
+  if (buf.size() < sizeof(MAGIC) ||
+      std::memcmp(ptr, MAGIC, sizeof(MAGIC)) != 0) {
+    throw Error{ErrorType::InvalidCheckpoint};
+  }
+  ptr += sizeof(MAGIC);
+  Checkpoint checkpoint;
+  checkpoint.input_offset = get<uint64_t>(ptr, end);
+  checkpoint.input_bits = get<uint32_t>(ptr, end);
+  checkpoint.state = get<uint32_t>(ptr, end);
+  checkpoint.member_idx = get<uint64_t>(ptr, end);
+  checkpoint.hlit = get<uint32_t>(ptr, end);
+  checkpoint.hdist = get<uint32_t>(ptr, end);
+  checkpoint.code_lengths = get_bytes(ptr, end);
+  checkpoint.window = get_bytes(ptr, end);
+  checkpoint.crc32 = get<uint32_t>(ptr, end);
+  checkpoint.size = get<uint32_t>(ptr, end);
+  checkpoint.members = get<uint64_t>(ptr, end);
+  checkpoint.output_offset = get<uint64_t>(ptr, end);
+  checkpoint.input.size = get<uint64_t>(ptr, end);
+  checkpoint.input.mtime = get<int64_t>(ptr, end);
+  if (ptr != end) throw Error{ErrorType::InvalidCheckpoint};
+  return checkpoint;
+}
+
+/**
+ * Positions the input and the output to continue from checkpoint, or to
+ * start over without one; the input must be the one it was taken on. The
+ * output is truncated either way: it may hold what a later run wrote past
+ * the checkpoint, or anything at all if there is no checkpoint.
+ */
+inline void seek_to(std::optional<Checkpoint> const &checkpoint, int in,
+                    int out) {
+  uint64_t offset = 0;
+  if (checkpoint) {
+    if (stamp_input(in) != checkpoint->input) {
+      throw Error{ErrorType::InvalidCheckpoint};  // not the same input
+    }
+    offset = checkpoint->output_offset;
+    struct stat st;
+    if (fstat(out, &st) != 0 || static_cast<uint64_t>(st.st_size) < offset) {
+      throw Error{ErrorType::InvalidCheckpoint};  // not the same output
+    }
+    if (lseek(in, checkpoint->input_offset, SEEK_SET) < 0) {
+      throw Error{ErrorType::StdIoError};
+    }
+  }
+  if (ftruncate(out, offset) != 0 || lseek(out, offset, SEEK_SET) < 0) {
+    throw Error{ErrorType::StdIoError};
+  }
+}
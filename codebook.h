@@ -1,7 +1,10 @@
 #pragma once
 
+#include <array>
+
 constexpr uint32_t MAX_CODELENGTH = 15;
 constexpr uint32_t MAX_LL_SYMBOL = 288;
+constexpr uint32_t MAX_DIST_SYMBOL = 32;
 
 class Codebook {
  public:
@@ -35,7 +38,7 @@ class Codebook {
       throw Error{ErrorType::InvalidCodeLengths};
     }
 
-    tree_.reserve(lengths.size());
+    size_ = 0;
     max_length_ = 0;
 
     // step 1
@@ -43,7 +46,7 @@ class Codebook {
     std::fill(bl_count, &bl_count[MAX_CODELENGTH + 1], 0);
     for (unsigned int length : lengths) {
       ++bl_count[length];
-      tree_.emplace_back(0, length);
+      tree_[size_++] = {0, length};
       max_length_ = std::max(max_length_, length);
     }
     if (max_length_ > MAX_CODELENGTH)
@@ -59,7 +62,8 @@ class Codebook {
     }
 
     // step 3
-    for (auto& pair : tree_) {
+    for (std::size_t i = 0; i < size_; ++i) {
+      auto& pair = tree_[i];
       std::size_t length = pair.second;
       if (length != 0) {
         pair.first = next_code[length];
@@ -70,13 +74,15 @@ class Codebook {
 
   uint32_t max_length() const { return max_length_; }
 
-  std::size_t size() const { return tree_.size(); }
+  std::size_t size() const { return size_; }
 
   std::pair<uint32_t, uint32_t> const& operator[](std::size_t idx) const {
     return tree_[idx];
   }
 
  private:
-  std::vector<std::pair<uint32_t, uint32_t>> tree_;  // bitcode, length
+  // bitcode, length; fixed capacity so that no allocation is made per block
+  std::array<std::pair<uint32_t, uint32_t>, MAX_LL_SYMBOL + 1> tree_;
+  std::size_t size_;
   uint32_t max_length_;
 };
\ No newline at end of file
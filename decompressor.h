@@ -1,10 +1,14 @@
 #pragma once
 
+#include <exception>
+#include <functional>
 #include <memory>
 #include <thread>
+#include <utility>
 
 #include "channel.h"
-#include "iterator.h"
+#include "memory_budget.h"
+#include "parallel_crc.h"
 #include "producer.h"
 #ifdef USE_FAST_CRC32
 #include "Crc32.h"
@@ -12,85 +16,420 @@
 #include "zlib.h"
 #endif
 
+// a member's checksum and size against its trailer
+struct MemberCheck {
+  std::size_t index;  // from 1
+  uint32_t crc32, size;
+  Footer footer;
+
+  bool ok() const { return crc32 == footer.crc32 && size == footer.size; }
+};
+
 template <typename Read>
 class Decompressor {
  public:
-  explicit Decompressor(Read &reader, bool multithread)
-      : begin_{0}, crc32_{0}, size_{0} {
-    if (multithread) {
-      Producer producer{reader};
-      auto [tx, rx] = make_channel<Produce>();
-      std::thread t{[](Channel<Produce> tx, Producer<Read> producer) {
-                      for (;;) {
-                        auto produce = producer.next();
-                        if (!produce) break;
-                        tx.send(std::move(*produce));
-                      }
-                    },
-                    std::move(tx), std::move(producer)};
-      thread_ = std::move(t);
-      iterator_ = std::make_unique<Channel<Produce>>(std::move(rx));
-    } else {
-      iterator_ = std::make_unique<Producer<Read>>(reader);
+  // with crc_threads > 0 in multithread mode, chunks are checksummed on that
+  // many worker threads instead of while they are copied out. A single
+  // thread hands out views into the window, which would have to wait for
+  // the workers before every step, so it ignores crc_threads.
+  explicit Decompressor(Read &reader, bool multithread,
+                        MemoryBudget *budget = nullptr,
+                        bool huge_pages = false, std::size_t crc_threads = 0)
+      : producer_{std::make_unique<Producer<Read>>(reader, budget,
+                                                   huge_pages)},
+        multithread_{multithread},
+        budget_{budget},
+        batch_begin_{0},
+        batch_end_{0},
+        held_{0},
+        chunk_{nullptr, nullptr},
+        crc32_{0},
+        size_{0},
+        members_{0},
+        unchecked_{false} {
+    if (crc_threads > 0 && multithread_) {
+      parallel_crc_ = std::make_unique<ParallelCrc32>(crc_threads);
     }
+    if (multithread_) start();
+  }
+
+  ~Decompressor() { stop(); }
+
+  // decompresses a new input, reusing the window and all the buffers
+  void reset(Read &reader) {
+    stop();
+    if (parallel_crc_) parallel_crc_->reset();
+    producer_->reset(reader);
+    chunk_ = Slice<uint8_t>{nullptr, nullptr};
+    crc32_ = 0;
+    size_ = 0;
+    members_ = 0;
+    unchecked_ = false;
+    if (multithread_) start();
   }
 
-  ~Decompressor() {
-    if (thread_) {
-      thread_->join();
+  /**
+   * Single-thread mode only, after read_view() or read() consumed their
+   * chunk. The state to continue from after the output handed out so far;
+   * the caller fills in the output offset and the input stamp.
+   */
+  Checkpoint checkpoint() {
+    assert(!multithread_ && chunk_.empty());
+    Checkpoint checkpoint;
+    producer_->save(checkpoint);
+    checkpoint.crc32 = crc32_;
+    checkpoint.size = size_;
+    checkpoint.members = members_;
+    checkpoint.output_offset = 0;
+    checkpoint.input = InputStamp{0, 0};
+    return checkpoint;
+  }
+
+  // single-thread mode only; the reader must be at the checkpoint's input
+  // offset
+  void restore(Checkpoint const &checkpoint) {
+    assert(!multithread_);
+    producer_->restore(checkpoint);
+    chunk_ = Slice<uint8_t>{nullptr, nullptr};
+    crc32_ = checkpoint.crc32;
+    size_ = checkpoint.size;
+    members_ = checkpoint.members;
+  }
+
+  /**
+   * Discards the next n bytes of output, or up to the end; returns how many
+   * were discarded. In single-thread mode they are only decoded into the
+   * window and never copied out. The checksums are not verified from then
+   * on, since they would not cover the skipped bytes.
+   */
+  uint64_t skip(uint64_t n) {
+    unchecked_ = true;
+    uint64_t skipped = 0;
+    while (skipped < n) {
+      if (chunk_.empty() && fill_buf() == 0) break;
+      auto len = std::min<uint64_t>(n - skipped, chunk_.size());
+      chunk_ = Slice{chunk_.begin() + len, chunk_.end()};
+      skipped += len;
     }
+    return skipped;
+  }
+
+  /**
+   * Decodes the rest of the input without handing it out: the checksum is
+   * computed on the window in place. Every member is passed to on_member
+   * instead of throwing on a mismatch; decoding errors still throw.
+   * Returns the number of bytes decoded.
+   */
+  template <typename OnMember>
+  uint64_t verify(OnMember on_member) {
+    on_member_ = on_member;
+    uint64_t total = 0;
+    for (auto xs = read_view(); !xs.empty(); xs = read_view()) {
+      total += xs.size();
+    }
+    on_member_ = nullptr;
+    return total;
+  }
+
+  // members whose trailer was checked so far
+  std::size_t members() const { return members_; }
+
+  /**
+   * Single-thread mode only. Shrinks an idle stream to its unread input and
+   * output, the live window and the code lengths of the current block; the
+   * next read() restores the window and rebuilds the Huffman tables.
+   */
+  void suspend() {
+    assert(!multithread_);
+    if (!chunk_.empty()) {
+      // chunk_ points into the window that is about to be freed
+      buf_.assign(chunk_.begin(), chunk_.end());
+      chunk_ = Slice{buf_.data(), buf_.data() + buf_.size()};
+    }
+    producer_->suspend();
+  }
+
+  // single-thread mode only; the output is decoded straight into the file
+  // and read_view() then points into it
+  void write_to(MappedOutput &output) {
+    assert(!multithread_);
+    producer_->write_to(output);
+  }
+
+  // the next chunk of output in place, valid until the next call; empty at
+  // the end
+  Slice<uint8_t> read_view() {
+    if (chunk_.empty() && fill_buf() == 0) return chunk_;
+    auto xs = chunk_;
+    checksum(xs);
+    chunk_ = Slice{xs.end(), xs.end()};
+    return xs;
+  }
+
+  // single-thread mode only; see Producer::stream(), and use read_some()
+  void stream(std::size_t max_chunk = 0) {
+    assert(!multithread_);
+    producer_->stream(max_chunk);
+  }
+
+  // like read() but returns as soon as some output is available rather
+  // than waiting to fill buf; 0 at the end
+  std::size_t read_some(Slice<uint8_t> buf) {
+    if (chunk_.empty() && fill_buf() == 0) return 0;
+    auto n = std::min(buf.size(), chunk_.size());
+    copy_and_checksum(buf.begin(), chunk_.begin(), n);
+    chunk_ = Slice{chunk_.begin() + n, chunk_.end()};
+    return n;
   }
 
   std::size_t read(Slice<uint8_t> buf) {
     std::size_t nbytes = 0;
     for (;;) {
-      auto n = std::min(buf.size(), buf_.size() - begin_);
-      std::copy(&buf_[begin_], &buf_[begin_ + n], buf.begin());
+      auto n = std::min(buf.size(), chunk_.size());
+      copy_and_checksum(buf.begin(), chunk_.begin(), n);
       buf = Slice{buf.begin() + n, buf.end()};
+      chunk_ = Slice{chunk_.begin() + n, chunk_.end()};
       nbytes += n;
-      begin_ += n;
       if (buf.empty() || fill_buf() == 0) break;
     }
     return nbytes;
   }
 
  private:
-  std::unique_ptr<Iterator<Produce>> iterator_;
-  std::vector<uint8_t> buf_;
-  std::size_t begin_;
+  // number of items moved per virtual call and per lock in multithread mode
+  static constexpr std::size_t BATCH_SIZE = 16;
+
+  std::unique_ptr<Producer<Read>> producer_;
+  bool multithread_;
+  MemoryBudget *budget_;
+  std::unique_ptr<Channel<Produce>> channel_;  // multithread mode only
+  std::optional<std::thread> thread_;
+  std::exception_ptr error_;  // thrown by the producer thread
+  std::vector<Produce> batch_;
+  std::size_t batch_begin_, batch_end_;
+  std::vector<uint8_t> buf_;  // owns chunk_ in multithread mode
+  std::size_t held_;          // bytes of buf_ acquired from budget_
+  std::shared_ptr<const void> chunk_owner_;  // owns it with parallel_crc_
+  std::unique_ptr<ParallelCrc32> parallel_crc_;  // computes crc32_ if set
+  Slice<uint8_t> chunk_;      // data not yet read
   uint32_t crc32_;
   uint32_t size_;
-  std::optional<std::thread> thread_;
+  std::size_t members_;
+  std::function<void(MemberCheck const &)> on_member_;  // set by verify()
+  bool unchecked_;  // set by skip()
 
-  std::size_t fill_buf() {
-    for (;;) {
-      auto iter_result = iterator_->next();
-      if (!iter_result) return 0;
-      switch (iter_result->index()) {
-        case 0:    // Header
-          break;   // nothing to do
-        case 1: {  // Footer
-          auto &footer = std::get<1>(*iter_result);
-          if (crc32_ != footer.crc32) throw Error{ErrorType::ChecksumMismatch};
-          if (size_ != footer.size) throw Error{ErrorType::SizeMismatch};
-          crc32_ = 0;
-          size_ = 0;
+  void start() {
+    batch_.resize(BATCH_SIZE);
+    auto [tx, rx] = make_channel<Produce>();
+    error_ = nullptr;
+    std::thread t{[budget = budget_, error = &error_](
+                      Channel<Produce> tx, Producer<Read> *producer) {
+                    // set before tx closes, so the consumer sees it after
+                    // the last item
+                    try {
+                      if (budget) {
+                        produce(tx, *producer, *budget);
+                        return;
+                      }
+                      std::vector<Produce> batch(BATCH_SIZE);
+                      // the consumer may have stopped reading
+                      while (!tx.is_closed()) {
+                        auto n = producer->next_batch(Slice{batch});
+                        if (n == 0 ||
+                            !tx.send_batch(Slice{&batch[0], &batch[n]})) {
+                          break;
+                        }
+                      }
+                    } catch (...) {
+                      *error = std::current_exception();
+                    }
+                  },
+                  std::move(tx), producer_.get()};
+    thread_ = std::move(t);
+    channel_ = std::make_unique<Channel<Produce>>(std::move(rx));
+  }
+
+  /**
+   * The producer thread under a budget. Each item is acquired before the
+   * next one is decoded, so that no more than one item is held beyond the
+   * limit. When the budget is exhausted, the items acquired so far are sent
+   * first, since the consumer can only release what it received.
+   */
+  static void produce(Channel<Produce> &tx, Producer<Read> &producer,
+                      MemoryBudget &budget) {
+    std::vector<Produce> batch(BATCH_SIZE);
+    std::size_t n = 0;     // items in batch
+    std::size_t held = 0;  // bytes acquired for them
+    auto send = [&] {
+      if (n > 0 && !tx.send_batch(Slice{&batch[0], &batch[n]})) return false;
+      n = held = 0;
+      return true;
+    };
+    while (!tx.is_closed()) {
+      auto &item = batch[n];
+      try {
+        if (producer.next_batch(Slice{&item, &item + 1}) == 0) break;
+      } catch (...) {
+        // the items acquired so far are output from before the error
+        if (!send()) budget.release(held);
+        throw;
+      }
+      auto bytes = footprint(item);
+      if (!budget.try_acquire(bytes)) {
+        auto next = std::move(item);
+        // blocks while the consumer is behind
+        if (!send() ||
+            !budget.acquire(bytes, [&tx] { return tx.is_closed(); })) {
           break;
         }
-        case 2: {  // Data
-          auto &xs = std::get<2>(*iter_result);
-          if (xs.empty()) continue;
+        batch[0] = std::move(next);
+      }
+      held += bytes;
+      if (++n == BATCH_SIZE && !send()) break;
+    }
+    if (!send()) budget.release(held);
+  }
+
+  void stop() {
+    if (!thread_) return;
+    // unblock the producer in case the output was not read till the end
+    channel_->close();
+    if (budget_) budget_->wake();
+    thread_->join();
+    thread_.reset();
+    // the consumer stopped before reaching it
+    error_ = nullptr;
+
+    release(held_);
+    held_ = 0;
+    while (batch_begin_ < batch_end_) {
+      release(footprint(batch_[batch_begin_++]));
+    }
+    while ((batch_end_ = channel_->next_batch(Slice{batch_})) != 0) {
+      for (std::size_t i = 0; i < batch_end_; ++i) {
+        release(footprint(batch_[i]));
+      }
+    }
+    batch_begin_ = 0;
+    channel_.reset();
+  }
+
+  void release(std::size_t n) {
+    if (budget_) budget_->release(n);
+  }
+
+  void check_footer(Footer const &footer) {
+    if (unchecked_) return;
+    if (parallel_crc_) {
+      crc32_ = parallel_crc_->wait();
+      parallel_crc_->reset();
+    }
+    MemberCheck check{++members_, crc32_, size_, footer};
+    crc32_ = 0;
+    size_ = 0;
+    if (on_member_) {
+      on_member_(check);
+      return;
+    }
+    if (check.crc32 != footer.crc32) throw Error{ErrorType::ChecksumMismatch};
+    if (check.size != footer.size) throw Error{ErrorType::SizeMismatch};
+  }
+
+  void checksum(Slice<uint8_t> xs) {
+    if (parallel_crc_ || unchecked_) return;
+#ifdef USE_FAST_CRC32
+    crc32_ = crc32_fast(xs.begin(), xs.size(), crc32_);
+#else
+    crc32_ = crc32(crc32_, xs.begin(), xs.size());
+#endif
+  }
+
+  // the checksum is computed as the data is handed out, in the same pass
+  void copy_and_checksum(uint8_t *dst, const uint8_t *src, std::size_t n) {
+    if (parallel_crc_ || unchecked_) {
+      std::copy(src, src + n, dst);
+      return;
+    }
 #ifdef USE_FAST_CRC32
-          crc32_ = crc32_fast(&xs[0], xs.size(), crc32_);
+    crc32_ = crc32_copy(dst, src, n, crc32_);
 #else
-          crc32_ = crc32(crc32_, &xs[0], xs.size());
+    std::copy(src, src + n, dst);
+    crc32_ = crc32(crc32_, dst, n);
 #endif
+  }
+
+  std::size_t fill_buf() {
+    return multithread_ ? fill_buf_from_channel() : fill_buf_from_producer();
+  }
+
+  // the data is read straight out of the producer's window; no chunk is
+  // allocated, which matters most for small inputs
+  std::size_t fill_buf_from_producer() {
+    if (!buf_.empty()) buf_ = std::vector<uint8_t>{};  // left by suspend()
+    for (;;) {
+      auto view = producer_->next_view();
+      if (!view) return 0;
+      switch (view->index()) {
+        case 0:  // Header
+          break;
+        case 1:  // Footer
+          check_footer(std::get<1>(*view));
+          break;
+        case 2: {  // Data
+          auto xs = std::get<2>(*view);
+          if (xs.empty()) continue;
           size_ += xs.size();
-          buf_ = std::move(xs);
-          begin_ = 0;
-          return buf_.size();
+          chunk_ = xs;
+          return chunk_.size();
+        }
+      }
+    }
+  }
+
+  std::size_t fill_buf_from_channel() {
+    // buf_ is fully consumed; give it back before waiting for the producer
+    release(held_);
+    held_ = 0;
+    if (budget_) buf_ = std::vector<uint8_t>{};
+    chunk_owner_.reset();
+    for (;;) {
+      if (batch_begin_ == batch_end_) {
+        batch_begin_ = 0;
+        batch_end_ = channel_->next_batch(Slice{batch_});
+        if (batch_end_ == 0) {
+          if (error_) std::rethrow_exception(std::exchange(error_, nullptr));
+          return 0;
+        }
+      }
+      auto &item = batch_[batch_begin_++];
+      switch (item.index()) {
+        case 0:    // Header
+          break;   // nothing to do
+        case 1:    // Footer
+          check_footer(std::get<1>(item));
+          break;
+        case 2: {  // Data
+          auto &xs = std::get<2>(item);
+          if (xs.empty()) {
+            release(footprint(item));
+            continue;
+          }
+          held_ = footprint(item);
+          if (parallel_crc_ && !unchecked_) {
+            // shared with the worker, which may still be reading it once
+            // it has been copied out
+            auto owner = std::make_shared<std::vector<uint8_t>>(std::move(xs));
+            chunk_ = Slice{owner->data(), owner->data() + owner->size()};
+            parallel_crc_->submit(chunk_, owner);
+            chunk_owner_ = std::move(owner);
+          } else {
+            buf_ = std::move(xs);
+            chunk_ = Slice{buf_.data(), buf_.data() + buf_.size()};
+          }
+          size_ += chunk_.size();
+          return chunk_.size();
         }
       }
     }
   }
-};
\ No newline at end of file
+};
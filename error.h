@@ -17,12 +17,15 @@ enum struct ErrorType {
   ReadDynamicCodebook,
   ChecksumMismatch,
   SizeMismatch,
+  InvalidCheckpoint,
 };
 
 struct Error : public std::exception {
  public:
   explicit Error(ErrorType error_type) : error_type{error_type} {}
 
+  ErrorType type() const noexcept { return error_type; }
+
   const char* what() const noexcept override {
     switch (error_type) {
       case ErrorType::StdIoError:
@@ -53,6 +56,8 @@ struct Error : public std::exception {
         return "ChecksumMismatch";
       case ErrorType::SizeMismatch:
         return "SizeMismatch";
+      case ErrorType::InvalidCheckpoint:
+        return "InvalidCheckpoint";
       default:
         return "Unknown Error";
     }
@@ -1,39 +1,490 @@
+#include <cerrno>
+#include <chrono>
 #include <cstring>
+#include <ctime>
+#include <iomanip>
 #include <iostream>
+#include <string>
+#include <thread>
 
+#include <fcntl.h>
+
+#include "checkpoint.h"
 #include "decompressor.h"
 #include "io.h"
+#include "io_uring.h"
+#include "list.h"
+#include "read_ahead.h"
+#include "strategy.h"
 
 int usage(std::string const& program) {
-  std::cerr << "usage: " << program << " [-t]\n";
+  std::cerr << "usage: " << program << " [-t] [options]\n";
   std::cerr
       << "\tDecompresses .gz file read from stdin and outputs to stdout\n";
   std::cerr << "\t-t: employ two threads\n";
+  std::cerr << "\t--auto: choose between one and two threads from the input "
+               "size and type, the output and the core count, timing both on "
+               "large files, and log the choice\n";
+  std::cerr << "\t-o FILE: write to FILE instead of stdout; a regular file is "
+               "decoded into directly (single thread)\n";
+  std::cerr << "\t--max-memory SIZE: block decoding while more than SIZE "
+               "bytes (K/M/G suffix) are held, and report the peak usage\n";
+  std::cerr << "\t--huge-pages: back the window and Huffman tables with "
+               "2 MiB pages\n";
+  std::cerr << "\t--crc-threads N: with -t, verify the checksum on N worker "
+               "threads\n";
+  std::cerr << "\t--list: print the sizes, member count, mtime and name "
+               "without writing the output\n";
+  std::cerr << "\t--scan: with --list, skip-decode every member instead of "
+               "trusting the trailer or the BGZF headers\n";
+  std::cerr << "\t--range START:LEN: output only LEN bytes from offset START "
+               "(K/M/G suffixes), stopping there; not checksummed\n";
+  std::cerr << "\t--checkpoint FILE: save the decoder state to FILE every "
+               "--checkpoint-every SIZE of output (default 1G); regular "
+               "files only, single thread\n";
+  std::cerr << "\t--resume: with --checkpoint, continue from the saved "
+               "state if there is one\n";
+  std::cerr << "\t--test: check every member without writing any output, "
+               "and report the throughput\n";
+  std::cerr << "\t--sparse: turn aligned all-zero blocks into holes when "
+               "writing to a regular file (not one opened for appending)\n";
+  std::cerr << "\t--stream: decode the input as it arrives and flush the "
+               "output whenever the input runs dry (single thread)\n";
+  std::cerr << "\t--follow: like --stream for a regular file that is still "
+               "being written: wait for it to grow at its end, until it is "
+               "deleted or renamed\n";
+  std::cerr << "\t--flush-every SIZE: with --stream, flush at least every "
+               "SIZE bytes of output\n";
+  std::cerr << "\t--read-ahead SIZE: read the input on a separate thread into "
+               "buffers of SIZE bytes, and report the time spent waiting for "
+               "it\n";
+  std::cerr << "\t--vmsplice: hand a pipe on stdout the pages of the output "
+               "instead of copying it (Linux); only safe if the reader copies "
+               "the data out rather than splicing it onward\n";
+  std::cerr << "\t--io-uring: read and write with io_uring when the kernel "
+               "supports it (Linux)\n";
   std::cerr << "\tExample: " << program << " < input.gz > output\n";
   return -1;
 }
 
 constexpr std::streamsize BUFFER_SIZE = 64 << 10;
 
-int main(int argc, const char** argv) {
-  std::ios_base::sync_with_stdio(false);
+// parses a byte count with an optional K, M or G suffix; returns 0 if invalid
+std::size_t parse_size(const char* str) {
+  char* end;
+  auto n = std::strtoull(str, &end, 10);
+  if (end == str) return 0;
+  switch (*end) {
+    case '\0':
+      return n;
+    case 'K':
+    case 'k':
+      n <<= 10;
+      break;
+    case 'M':
+    case 'm':
+      n <<= 20;
+      break;
+    case 'G':
+    case 'g':
+      n <<= 30;
+      break;
+    default:
+      return 0;
+  }
+  return end[1] == '\0' ? n : 0;
+}
+
+// parses START:LEN, both as for parse_size; false if invalid
+bool parse_range(const char* str, uint64_t& begin, uint64_t& size) {
+  auto colon = std::strchr(str, ':');
+  if (!colon) return false;
+  std::string start{str, colon};
+  begin = start == "0" ? 0 : parse_size(start.c_str());
+  size = parse_size(colon + 1);
+  return size > 0 && (begin > 0 || start == "0");
+}
 
+struct Options {
   bool multithread = false;
-  if (argc == 2 && std::strcmp("-t", argv[1]) == 0) {
-    multithread = true;
-  } else if (argc != 1) {
-    return usage(argv[0]);
+  bool auto_select = false;
+  bool huge_pages = false;
+  std::size_t crc_threads = 0;
+  MemoryBudget* budget = nullptr;
+  int output = -1;  // mapped regular file to decode into, if any
+  bool io_uring = false;
+  bool vmsplice = false;
+  std::size_t read_ahead = 0;  // buffer size of the read-ahead thread
+  bool list = false;
+  bool scan = false;
+  bool test = false;
+  std::string checkpoint;  // file to save the decoder state to, if any
+  uint64_t checkpoint_every = 1 << 30;
+  bool resume = false;
+  uint64_t range_begin = 0;
+  uint64_t range_size = 0;  // no range if 0
+  bool sparse = false;
+  bool stream = false;
+  bool follow = false;
+  std::size_t flush_every = 0;
+};
+
+// ISIZE of the last member, which is the size of single-member inputs
+std::size_t size_hint(int fd) {
+  struct stat st;
+  uint8_t buf[4];
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < 18 ||
+      pread(fd, buf, 4, st.st_size - 4) != 4) {
+    return 0;
   }
+  return buf[0] | buf[1] << 8 | buf[2] << 16 |
+         static_cast<uint32_t>(buf[3]) << 24;
+}
 
-  Stdin in;
-  Stdout out;
-  Decompressor decompressor{in, multithread};
+template <typename Read, typename Write>
+void write_all(Decompressor<Read>& decompressor, Write& out,
+               MemoryBudget* budget) {
   std::vector<uint8_t> buffer(BUFFER_SIZE, 0);
+  Charge charge{budget, buffer.size()};
   Slice buf{buffer};
   while (true) {
     auto n = decompressor.read(buf);
     out.write(Slice{buf.begin(), buf.begin() + n});
     if (n < BUFFER_SIZE) break;
   }
+}
+
+void print_listing(Listing const& listing) {
+  auto& head = listing.header.head;
+  std::time_t mtime = head[4] | head[5] << 8 | head[6] << 16 |
+                      static_cast<uint32_t>(head[7]) << 24;
+  char date[32] = "-";
+  std::tm tm;
+  if (mtime != 0 && localtime_r(&mtime, &tm)) {
+    std::strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+  }
+  auto ratio = listing.size == 0 ? 0.0
+                                 : 100.0 * (1.0 - static_cast<double>(
+                                                      listing.compressed) /
+                                                      listing.size);
+  std::cout << std::setw(14) << "compressed" << std::setw(16)
+            << "uncompressed" << std::setw(8) << "ratio" << std::setw(9)
+            << "members" << "  method     mtime                name\n";
+  std::cout << std::setw(14) << listing.compressed << std::setw(16)
+            << listing.size << std::setw(7) << std::fixed
+            << std::setprecision(1) << ratio << "%" << std::setw(9)
+            << listing.members << "  " << std::left << std::setw(11)
+            << listing.method << std::setw(21) << date;
+  if (auto& name = listing.header.name) {
+    std::cout.write(reinterpret_cast<const char*>(name->data()),
+                    name->empty() ? 0 : name->size() - 1);
+  }
+  std::cout << "\n";
+}
+
+/**
+ * Decodes a regular file into a regular stdout, syncing the output and
+ * saving a checkpoint every checkpoint_every bytes. With resume, the output
+ * is truncated to the last checkpoint and decoding continues from there;
+ * without a checkpoint to resume from, it starts over on an empty output.
+ */
+int resumable(Options const& options) {
+  std::optional<Checkpoint> checkpoint;
+  if (options.resume) checkpoint = load_checkpoint(options.checkpoint);
+  seek_to(checkpoint, STDIN_FILENO, STDOUT_FILENO);
+  uint64_t offset = checkpoint ? checkpoint->output_offset : 0;
+  auto input = stamp_input(STDIN_FILENO);
+  MappedFile in{STDIN_FILENO};
+  Decompressor decompressor{in, false, options.budget, options.huge_pages};
+  if (checkpoint) decompressor.restore(*checkpoint);
+
+  Stdout out;
+  auto next = offset + options.checkpoint_every;
+  for (auto xs = decompressor.read_view(); !xs.empty();
+       xs = decompressor.read_view()) {
+    out.write(xs);
+    offset += xs.size();
+    if (offset < next) continue;
+    // the output must be on disk before the checkpoint that refers to it
+    out.flush();
+    if (fdatasync(STDOUT_FILENO) != 0) throw Error{ErrorType::StdIoError};
+    auto state = decompressor.checkpoint();
+    state.output_offset = offset;
+    state.input = input;
+    save_checkpoint(state, options.checkpoint);
+    next = offset + options.checkpoint_every;
+  }
+  out.flush();
+  unlink(options.checkpoint.c_str());
+  return 0;
+}
+
+// checks every member, decoding only into the window; returns the exit
+// status
+template <typename Read>
+int test(Decompressor<Read>& decompressor) {
+  auto start = std::chrono::steady_clock::now();
+  uint64_t total = 0;
+  bool ok = true;
+  try {
+    total = decompressor.verify([&](MemberCheck const& check) {
+      std::cout << "member " << check.index << ": ";
+      if (check.ok()) {
+        std::cout << "OK\n";
+      } else {
+        ok = false;
+        std::cout << "FAILED (crc32 " << std::hex << check.crc32
+                  << ", expected " << check.footer.crc32 << std::dec
+                  << "; size " << check.size << ", expected "
+                  << check.footer.size << ")\n";
+      }
+    });
+  } catch (Error const& e) {
+    ok = false;
+    std::cout << "member " << decompressor.members() + 1 << ": " << e.what()
+              << "\n";
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << total << " bytes in " << elapsed.count() << " s ("
+            << total / elapsed.count() / 1e6 << " MB/s)\n";
+  return ok ? 0 : 1;
+}
+
+template <typename Read>
+int decompress(Read& in, Options const& options) {
+  // the decoder writes its output in place; there is nothing to hand over
+  // to a second thread. A range ends early, and stopping the producer would
+  // wait for its read on a pipe to return.
+  auto multithread = options.multithread && options.output < 0 &&
+                     !options.stream && !options.test &&
+                     options.range_size == 0;
+  Decompressor decompressor{in, multithread, options.budget,
+                            options.huge_pages, options.crc_threads};
+  if (options.test) return test(decompressor);
+  if (options.range_size > 0) {
+    // the bytes before the range never leave the window
+    decompressor.skip(options.range_begin);
+    Stdout out;
+    for (auto left = options.range_size; left > 0;) {
+      auto xs = decompressor.read_view();
+      if (xs.empty()) break;
+      auto n = std::min<uint64_t>(left, xs.size());
+      out.write(Slice{xs.begin(), xs.begin() + n});
+      left -= n;
+    }
+    return 0;
+  }
+  if (options.stream) {
+    decompressor.stream(options.flush_every);
+    Stdout out;
+    std::vector<uint8_t> buffer(BUFFER_SIZE, 0);
+    Charge charge{options.budget, buffer.size()};
+    while (auto n = decompressor.read_some(Slice{buffer})) {
+      out.write(Slice{buffer.data(), buffer.data() + n});
+      out.flush();
+    }
+    return 0;
+  }
+  if (options.output >= 0) {
+    MappedOutput out{options.output, size_hint(STDIN_FILENO)};
+    decompressor.write_to(out);
+    while (!decompressor.read_view().empty()) {
+    }
+    out.finish();
+    return 0;
+  }
+
+  // otherwise the zero blocks are written like the rest
+  if (options.sparse && SparseWriter::usable(STDOUT_FILENO)) {
+    SparseWriter out{STDOUT_FILENO};
+    write_all(decompressor, out, options.budget);
+    out.finish();
+    return 0;
+  }
+#ifdef __linux__
+  if (options.io_uring) {
+    UringWriter out{STDOUT_FILENO};
+    Charge charge{options.budget, out.capacity()};
+    write_all(decompressor, out, options.budget);
+    out.flush();
+    return 0;
+  }
+  // the output is decompressed into pages that the pipe then references
+  if (options.vmsplice && PipeWriter::is_pipe(STDOUT_FILENO)) {
+    PipeWriter out{STDOUT_FILENO, BUFFER_SIZE};
+    Charge charge{options.budget, out.capacity()};
+    while (true) {
+      auto buf = out.buffer();
+      auto n = decompressor.read(buf);
+      out.commit(n);
+      if (n < buf.size()) break;
+    }
+    return 0;
+  }
+#endif
+
+  Stdout out;
+  write_all(decompressor, out, options.budget);
   return 0;
 }
+
+int main(int argc, const char** argv) {
+  std::ios_base::sync_with_stdio(false);
+
+  Options options;
+  std::optional<MemoryBudget> budget;
+  const char* output = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp("-t", argv[i]) == 0) {
+      options.multithread = true;
+    } else if (std::strcmp("--auto", argv[i]) == 0) {
+      options.auto_select = true;
+    } else if (std::strcmp("-o", argv[i]) == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (std::strcmp("--max-memory", argv[i]) == 0 && i + 1 < argc) {
+      auto limit = parse_size(argv[++i]);
+      if (limit == 0) return usage(argv[0]);
+      budget.emplace(limit);
+      options.budget = &*budget;
+    } else if (std::strcmp("--huge-pages", argv[i]) == 0) {
+      options.huge_pages = true;
+    } else if (std::strcmp("--list", argv[i]) == 0) {
+      options.list = true;
+    } else if (std::strcmp("--scan", argv[i]) == 0) {
+      options.scan = true;
+    } else if (std::strcmp("--range", argv[i]) == 0 && i + 1 < argc) {
+      if (!parse_range(argv[++i], options.range_begin, options.range_size)) {
+        return usage(argv[0]);
+      }
+    } else if (std::strcmp("--checkpoint", argv[i]) == 0 && i + 1 < argc) {
+      options.checkpoint = argv[++i];
+    } else if (std::strcmp("--checkpoint-every", argv[i]) == 0 &&
+               i + 1 < argc) {
+      options.checkpoint_every = parse_size(argv[++i]);
+      if (options.checkpoint_every == 0) return usage(argv[0]);
+    } else if (std::strcmp("--resume", argv[i]) == 0) {
+      options.resume = true;
+    } else if (std::strcmp("--test", argv[i]) == 0) {
+      options.test = true;
+    } else if (std::strcmp("--sparse", argv[i]) == 0) {
+      options.sparse = true;
+    } else if (std::strcmp("--stream", argv[i]) == 0) {
+      options.stream = true;
+    } else if (std::strcmp("--follow", argv[i]) == 0) {
+      options.follow = options.stream = true;
+    } else if (std::strcmp("--flush-every", argv[i]) == 0 && i + 1 < argc) {
+      options.flush_every = parse_size(argv[++i]);
+      if (options.flush_every == 0) return usage(argv[0]);
+    } else if (std::strcmp("--read-ahead", argv[i]) == 0 && i + 1 < argc) {
+      options.read_ahead = parse_size(argv[++i]);
+      if (options.read_ahead == 0) return usage(argv[0]);
+    } else if (std::strcmp("--vmsplice", argv[i]) == 0) {
+      options.vmsplice = true;
+    } else if (std::strcmp("--io-uring", argv[i]) == 0) {
+#ifdef __linux__
+      options.io_uring = IoUring::supported();
+#endif
+    } else if (std::strcmp("--crc-threads", argv[i]) == 0 && i + 1 < argc) {
+      options.crc_threads = std::strtoull(argv[++i], nullptr, 10);
+      if (options.crc_threads == 0) return usage(argv[0]);
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  // a single thread checksums the output while copying it out
+  if (options.crc_threads > 0 && !options.multithread &&
+      !options.auto_select) {
+    return usage(argv[0]);
+  }
+
+  if (output) {
+    // a resumed output is truncated to the checkpoint instead
+    auto flags = O_RDWR | O_CREAT | (options.resume ? 0 : O_TRUNC);
+    auto fd = open(output, flags, 0666);
+    if (fd < 0) {
+      std::cerr << output << ": " << std::strerror(errno) << "\n";
+      return 1;
+    }
+    if (MappedFile::mappable(fd)) {
+      options.output = fd;
+    } else if (dup2(fd, STDOUT_FILENO) < 0) {
+      return 1;
+    }
+  }
+
+  if (options.list) {
+    if (MappedFile::mappable(STDIN_FILENO)) {
+      print_listing(list_file(STDIN_FILENO, options.scan));
+    } else {
+      Stdin in;
+      print_listing(list_stream(in));
+    }
+    return 0;
+  }
+
+  // holes are made by seeking over them rather than through the mapping, a
+  // range is small enough to be written, and checkpoints need a file offset
+  if ((options.sparse || options.range_size > 0 ||
+       !options.checkpoint.empty()) &&
+      options.output >= 0) {
+    if (dup2(options.output, STDOUT_FILENO) < 0) return 1;
+    options.output = -1;
+  }
+
+  if (!options.checkpoint.empty()) {
+    if (!MappedFile::mappable(STDIN_FILENO) ||
+        !MappedFile::mappable(STDOUT_FILENO)) {
+      return usage(argv[0]);
+    }
+    return resumable(options);
+  }
+
+  if (options.auto_select) {
+    auto profile = profile_input(STDIN_FILENO,
+                                 std::thread::hardware_concurrency());
+    auto strategy =
+        options.stream || options.test
+            ? Strategy{false, "--stream and --test decode on one thread"}
+            : choose_strategy(profile, STDIN_FILENO, options.output >= 0);
+    options.multithread = strategy.multithread;
+    std::cerr << "auto: " << describe(profile) << ": "
+              << (strategy.multithread ? "two threads" : "one thread")
+              << ", since " << strategy.reason << "\n";
+  }
+
+  int status;
+  if (options.follow) {
+    if (!MappedFile::mappable(STDIN_FILENO)) return usage(argv[0]);
+    FollowReader in{STDIN_FILENO};
+    status = decompress(in, options);
+  } else if (options.stream) {
+    FdReader in{STDIN_FILENO};
+    status = decompress(in, options);
+  } else if (MappedFile::mappable(STDIN_FILENO)) {
+    // a regular file is decoded in place rather than read through a buffer
+    MappedFile in{STDIN_FILENO};
+    status = decompress(in, options);
+#ifdef __linux__
+  } else if (options.io_uring) {
+    UringReader in{STDIN_FILENO};
+    Charge charge{options.budget, in.capacity()};
+    status = decompress(in, options);
+#endif
+  } else if (options.read_ahead > 0) {
+    Stdin stdin_reader;
+    ReadAhead in{stdin_reader, options.read_ahead};
+    Charge charge{options.budget, in.capacity()};
+    status = decompress(in, options);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        in.wait_time());
+    std::cerr << "waited for input: " << ms.count() << " ms\n";
+  } else {
+    Stdin in;
+    status = decompress(in, options);
+  }
+  if (budget) {
+    std::cerr << "peak memory usage: " << budget->peak() << " bytes\n";
+  }
+  return status;
+}
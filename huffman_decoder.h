@@ -1,17 +1,28 @@
 #pragma once
 
-#include <vector>
+#include <memory>
 
+#include "arena.h"
 #include "codebook.h"
 
 constexpr uint32_t NUM_BITS_FIRST_LOOKUP = 9;
 
+// upper bound on the lookup table entries of a decoder for an alphabet of n
+// symbols: the primary table plus one secondary table per symbol
+constexpr std::size_t max_lookup_size(std::size_t n) {
+  return (1 << NUM_BITS_FIRST_LOOKUP) +
+         n * (1 << (MAX_CODELENGTH - NUM_BITS_FIRST_LOOKUP));
+}
+
 class HuffmanDecoder {
  public:
   // uninitialized
-  HuffmanDecoder() : primary_mask_{0}, secondary_mask_{0} {}
+  HuffmanDecoder()
+      : lookup_{nullptr, nullptr}, primary_mask_{0}, secondary_mask_{0} {}
 
-  explicit HuffmanDecoder(Codebook const& codebook) {
+  // the lookup table is allocated from the arena and lives as long as it
+  explicit HuffmanDecoder(Codebook const& codebook, Arena& arena)
+      : lookup_{nullptr, nullptr} {
     auto max_nbits = codebook.max_length();
     uint32_t nbits;
     if (max_nbits > NUM_BITS_FIRST_LOOKUP) {
@@ -23,7 +34,23 @@ class HuffmanDecoder {
     }
     primary_mask_ = (1 << nbits) - 1;
 
-    lookup_.resize(1 << nbits, std::make_pair(0, 0));
+    // size the table up front: one secondary table per distinct prefix
+    bool has_secondary[1 << NUM_BITS_FIRST_LOOKUP] = {};
+    std::size_t table_size = 1 << nbits;
+    for (uint32_t symbol = 0; symbol < codebook.size(); ++symbol) {
+      uint32_t bitcode, length;
+      std::tie(bitcode, length) = codebook[symbol];
+      if (length <= nbits) continue;
+      auto base = (reverse_bits(bitcode) >> (16 - length)) & primary_mask_;
+      if (!has_secondary[base]) {
+        has_secondary[base] = true;
+        table_size += 1 << (max_nbits - nbits);
+      }
+    }
+    lookup_ = arena.allocate<std::pair<uint32_t, uint32_t>>(table_size);
+    std::uninitialized_fill(lookup_.begin(), lookup_.end(),
+                            std::make_pair(0, 0));
+    std::size_t used = 1 << nbits;
     for (uint32_t symbol = 0; symbol < codebook.size(); ++symbol) {
       uint32_t bitcode, length;
       std::tie(bitcode, length) = codebook[symbol];
@@ -41,10 +68,9 @@ class HuffmanDecoder {
         std::size_t base = bitcode & primary_mask_;
         uint32_t offset;
         if (lookup_[base].first == 0) {
-          offset = lookup_.size();
+          offset = used;
           lookup_[base] = {offset, length};
-          auto new_len = lookup_.size() + (1 << (max_nbits - nbits));
-          lookup_.resize(new_len, {0, 0});
+          used += 1 << (max_nbits - nbits);
         } else {
           offset = lookup_[base].first;
         }
@@ -58,20 +84,21 @@ class HuffmanDecoder {
     }
   }
 
-  std::pair<uint32_t, uint32_t> decode(uint32_t bits) const {
+  __attribute__((always_inline)) std::pair<uint32_t, uint32_t> decode(
+      uint32_t bits) const {
     uint32_t symbol, length;
-    std::tie(symbol, length) = lookup_[bits & primary_mask_];
+    std::tie(symbol, length) = lookup_.begin()[bits & primary_mask_];
     if (length == 0) throw Error{ErrorType::HuffmanDecoderCodeNotFound};
     if (length <= NUM_BITS_FIRST_LOOKUP) {
       return {symbol, length};
     }
     std::size_t base = symbol;
     auto idx = (bits >> NUM_BITS_FIRST_LOOKUP) & secondary_mask_;
-    return lookup_[base + idx];
+    return lookup_.begin()[base + idx];
   }
 
  private:
-  std::vector<std::pair<uint32_t, uint32_t>> lookup_;
+  Slice<std::pair<uint32_t, uint32_t>> lookup_;
   uint32_t primary_mask_, secondary_mask_;
 
   // declared as static so that we can define it in the header file
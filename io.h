@@ -1,19 +1,38 @@
 #pragma once
 
+#include <algorithm>
+#include <cerrno>
 #include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <limits>
+#include <string>
 #include <vector>
 
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/uio.h>
+#endif
+
 #include "error.h"
 #include "slice.h"
 
 /**
  * These are implicit interfaces that will used in the library
  *
- * read n-bytes or until EOF. Throws on error.
+ * read up to n bytes; fewer than n only if no more are available right now
+ * (e.g. a pipe) or at EOF, and 0 only at EOF. Throws on error.
  * std::size_t read(Slice<uint8_t> buf);
  *
+ * optionally, for inputs held in memory: hands over the rest of the input in
+ * place, valid as long as the reader; reads return EOF afterwards.
+ * Slice<uint8_t> view();
+ *
  * read until byte is read or EOF. Throws on error.
  * std::size_t read_until(uint8_t byte, std::vector<uint8_t> &buf_);
  *
@@ -43,12 +62,241 @@ struct Cin {
   }
 };
 
+// reads with read(2), returning whatever is available instead of waiting
+// for the whole buffer, so that a stream arriving in pieces is decoded as
+// it comes
+struct FdReader {
+  int fd;
+
+  std::size_t read(Slice<uint8_t> buf) {
+    for (;;) {
+      auto n = ::read(fd, buf.begin(), buf.size());
+      if (n >= 0) return n;
+      if (errno != EINTR) throw Error{ErrorType::StdIoError};
+    }
+  }
+};
+
+/**
+ * Reads a regular file that is still being appended to: at its end, read()
+ * waits for the file to grow instead of returning EOF, so that a decoder
+ * simply stays where it stopped, mid-block or mid-header. EOF is returned
+ * once the file has been deleted or renamed (e.g. rotated) and read to its
+ * end.
+ *
+ * Growth is waited for with inotify where available, and otherwise, or as a
+ * fallback for missed events, by polling every poll_ms milliseconds.
+ */
+class FollowReader {
+ public:
+  explicit FollowReader(int fd, int poll_ms = 1000)
+      : fd_{fd}, poll_ms_{poll_ms}, inotify_{-1}, gone_{false} {
+#ifdef __linux__
+    inotify_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    auto path = "/proc/self/fd/" + std::to_string(fd);
+    if (inotify_ >= 0 &&
+        inotify_add_watch(inotify_, path.c_str(),
+                          IN_MODIFY | IN_DELETE_SELF | IN_MOVE_SELF |
+                              IN_ATTRIB) < 0) {
+      close(inotify_);
+      inotify_ = -1;
+    }
+#endif
+  }
+
+  FollowReader(FollowReader const&) = delete;
+  FollowReader& operator=(FollowReader const&) = delete;
+
+  ~FollowReader() {
+    if (inotify_ >= 0) close(inotify_);
+  }
+
+  std::size_t read(Slice<uint8_t> buf) {
+    for (;;) {
+      auto n = ::read(fd_, buf.begin(), buf.size());
+      if (n > 0) return n;
+      if (n < 0 && errno != EINTR) throw Error{ErrorType::StdIoError};
+      if (n < 0) continue;
+      // the last read after the file went away found nothing more
+      if (gone_) return 0;
+      wait();
+    }
+  }
+
+ private:
+  int fd_;
+  int poll_ms_;
+  int inotify_;
+  bool gone_;
+
+  void wait() {
+    if (inotify_ < 0) {
+      poll(nullptr, 0, poll_ms_);
+    } else {
+      pollfd pfd{inotify_, POLLIN, 0};
+      poll(&pfd, 1, poll_ms_);
+#ifdef __linux__
+      alignas(inotify_event) char events[4096];
+      ssize_t n;
+      while ((n = ::read(inotify_, events, sizeof(events))) > 0) {
+        for (auto ptr = events; ptr < events + n;) {
+          auto event = reinterpret_cast<inotify_event*>(ptr);
+          if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) gone_ = true;
+          ptr += sizeof(inotify_event) + event->len;
+        }
+      }
+#endif
+    }
+    // deleted files and missed events
+    struct stat st;
+    if (fstat(fd_, &st) == 0 && st.st_nlink == 0) gone_ = true;
+  }
+};
+
+// reads from a buffer in memory
+struct MemoryReader {
+  const uint8_t* begin;
+  const uint8_t* end;
+
+  std::size_t read(Slice<uint8_t> buf) {
+    auto n = std::min<std::size_t>(buf.size(), end - begin);
+    std::copy(begin, begin + n, buf.begin());
+    begin += n;
+    return n;
+  }
+};
+
+// maps a regular file, from its current offset, into memory so that it is
+// decoded in place instead of being copied through a buffer
+class MappedFile {
+ public:
+  explicit MappedFile(int fd) : begin_{nullptr}, size_{0}, pos_{0} {
+    struct stat st;
+    if (fstat(fd, &st) != 0) throw Error{ErrorType::StdIoError};
+    auto offset = lseek(fd, 0, SEEK_CUR);
+    size_ = st.st_size;
+    pos_ = offset > 0 ? std::min<std::size_t>(offset, size_) : 0;
+    if (size_ == 0) return;
+    auto ptr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr == MAP_FAILED) throw Error{ErrorType::StdIoError};
+    begin_ = static_cast<uint8_t*>(ptr);
+    // best effort
+    madvise(ptr, size_, MADV_SEQUENTIAL);
+    madvise(ptr, size_, MADV_WILLNEED);
+  }
+
+  MappedFile(MappedFile const&) = delete;
+  MappedFile& operator=(MappedFile const&) = delete;
+
+  ~MappedFile() {
+    if (begin_) munmap(begin_, size_);
+  }
+
+  // whether fd is a regular file, which can be mapped
+  static bool mappable(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+  }
+
+  std::size_t read(Slice<uint8_t> buf) {
+    auto n = std::min(buf.size(), size_ - pos_);
+    std::copy(begin_ + pos_, begin_ + pos_ + n, buf.begin());
+    pos_ += n;
+    return n;
+  }
+
+  Slice<uint8_t> view() {
+    auto begin = begin_ + pos_;
+    pos_ = size_;
+    return Slice{begin, begin_ + size_};
+  }
+
+ private:
+  uint8_t* begin_;
+  std::size_t size_, pos_;
+};
+
 // wrapper around stdout
 struct Stdout {
   void write(Slice<uint8_t> buf) {
     fwrite(buf.begin(), 1, buf.size(), stdout);
     if (ferror(stdout)) throw Error{ErrorType::StdIoError};
   }
+
+  void flush() {
+    if (fflush(stdout) != 0) throw Error{ErrorType::StdIoError};
+  }
+};
+
+// writes to a regular file, seeking over aligned all-zero blocks so that
+// they become holes; see usable()
+class SparseWriter {
+ public:
+  explicit SparseWriter(int fd) : fd_{fd}, offset_{lseek(fd, 0, SEEK_CUR)} {
+    if (offset_ < 0) throw Error{ErrorType::StdIoError};
+  }
+
+  // whether fd is a regular file that holds no data past its offset and is
+  // not in append mode, where seeking would not move the next write
+  static bool usable(int fd) {
+    struct stat st;
+    auto flags = fcntl(fd, F_GETFL);
+    auto offset = lseek(fd, 0, SEEK_CUR);
+    return fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && flags >= 0 &&
+           (flags & O_APPEND) == 0 && offset >= 0 && st.st_size <= offset;
+  }
+
+  void write(Slice<uint8_t> buf) {
+    auto begin = buf.begin();
+    while (begin < buf.end()) {
+      // up to the next block boundary, then whole blocks
+      auto len = std::min<std::size_t>(
+          BLOCK_SIZE - offset_ % BLOCK_SIZE, buf.end() - begin);
+      auto zero = len == BLOCK_SIZE && is_zero(begin, len);
+      auto end = begin + len;
+      while (end < buf.end()) {
+        auto n = std::min<std::size_t>(BLOCK_SIZE, buf.end() - end);
+        if (n < BLOCK_SIZE || is_zero(end, n) != zero) break;
+        end += n;
+      }
+      if (zero) {
+        if (lseek(fd_, end - begin, SEEK_CUR) < 0) {
+          throw Error{ErrorType::StdIoError};
+        }
+        offset_ += end - begin;
+        begin = end;
+        continue;
+      }
+      while (begin < end) {
+        auto n = ::write(fd_, begin, end - begin);
+        if (n < 0 && errno != EINTR) throw Error{ErrorType::StdIoError};
+        if (n > 0) {
+          begin += n;
+          offset_ += n;
+        }
+      }
+    }
+  }
+
+  // extends the file in case it ends with a hole
+  void finish() {
+    struct stat st;
+    if (fstat(fd_, &st) != 0) throw Error{ErrorType::StdIoError};
+    if (st.st_size < offset_ && ftruncate(fd_, offset_) != 0) {
+      throw Error{ErrorType::StdIoError};
+    }
+  }
+
+ private:
+  static constexpr std::size_t BLOCK_SIZE = 4096;
+
+  int fd_;
+  off_t offset_;
+
+  // memcmp is vectorized by the C library
+  static bool is_zero(const uint8_t* data, std::size_t n) {
+    return data[0] == 0 && std::memcmp(data, data + 1, n - 1) == 0;
+  }
 };
 
 // wrapper around cout
@@ -60,3 +308,88 @@ struct Cout {
     std::cout.write(reinterpret_cast<char*>(buf.begin()), buf.size());
   }
 };
+
+#ifdef __linux__
+/**
+ * Writes to a pipe by handing it references to the pages of its own buffers
+ * with vmsplice, instead of copying everything through stdio and then into
+ * the pipe. The output is produced in place: fill buffer() and commit() it.
+ *
+ * A pipe holds at most its size in pages, so a buffer page is reused only
+ * after twice that much was spliced behind it, by which time a reader that
+ * copies the data out has consumed it. A reader that splices the pages
+ * onward, e.g. into another pipe or a socket, may still reference them when
+ * they are rewritten, so this is opt-in (--vmsplice).
+ */
+class PipeWriter {
+ public:
+  explicit PipeWriter(int fd, std::size_t chunk_size = 64 << 10)
+      : fd_{fd}, chunk_size_{chunk_size}, cur_{0}, splice_{true} {
+    // best effort; unprivileged users may grow it up to pipe-max-size
+    fcntl(fd_, F_SETPIPE_SZ, PIPE_SIZE);
+    auto pipe_size = fcntl(fd_, F_GETPIPE_SZ);
+    if (pipe_size <= 0) pipe_size = PIPE_SIZE;
+    auto chunks = (2 * static_cast<std::size_t>(pipe_size) + chunk_size_ - 1) /
+                  chunk_size_;
+    size_ = std::max<std::size_t>(chunks, 2) * chunk_size_;
+    auto ptr = mmap(nullptr, size_, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) throw Error{ErrorType::StdIoError};
+    ring_ = static_cast<uint8_t*>(ptr);
+  }
+
+  PipeWriter(PipeWriter const&) = delete;
+  PipeWriter& operator=(PipeWriter const&) = delete;
+
+  ~PipeWriter() { munmap(ring_, size_); }
+
+  static bool is_pipe(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+  }
+
+  // bytes of ring memory, e.g. to charge a MemoryBudget
+  std::size_t capacity() const { return size_; }
+
+  // page-aligned space for the next chunk of output
+  Slice<uint8_t> buffer() {
+    return Slice{ring_ + cur_, ring_ + cur_ + chunk_size_};
+  }
+
+  // passes the first n bytes of buffer() on to the pipe
+  void commit(std::size_t n) {
+    auto begin = ring_ + cur_;
+    auto end = begin + n;
+    while (begin < end) {
+      auto written = splice_ ? splice(begin, end - begin)
+                             : ::write(fd_, begin, end - begin);
+      if (written >= 0) {
+        begin += written;
+      } else if (errno == EAGAIN) {
+        pollfd pfd{fd_, POLLOUT, 0};
+        poll(&pfd, 1, -1);
+      } else if (errno == EINVAL || errno == ENOSYS) {
+        splice_ = false;  // e.g. not supported by this kind of pipe
+      } else if (errno != EINTR) {
+        throw Error{ErrorType::StdIoError};
+      }
+    }
+    cur_ += chunk_size_;
+    if (cur_ == size_) cur_ = 0;
+  }
+
+ private:
+  static constexpr int PIPE_SIZE = 1 << 20;
+
+  int fd_;
+  std::size_t chunk_size_;
+  std::size_t size_, cur_;
+  uint8_t* ring_;
+  bool splice_;
+
+  ssize_t splice(uint8_t* begin, std::size_t n) {
+    iovec iov{begin, n};
+    return vmsplice(fd_, &iov, 1, 0);
+  }
+};
+#endif
@@ -0,0 +1,356 @@
+#pragma once
+
+#ifdef __linux__
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "slice.h"
+
+/**
+ * Minimal io_uring on top of the raw system calls. Every operation is
+ * submitted on its own and identified by its user_data on completion.
+ */
+class IoUring {
+ public:
+  explicit IoUring(unsigned entries) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    fd_ = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd_ < 0) throw Error{ErrorType::StdIoError};
+
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sq_ = map(sq_size_, IORING_OFF_SQ_RING);
+    cq_ = map(cq_size_, IORING_OFF_CQ_RING);
+    sqes_ = static_cast<io_uring_sqe *>(map(sqes_size_, IORING_OFF_SQES));
+
+    auto sq = static_cast<uint8_t *>(sq_);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    auto cq = static_cast<uint8_t *>(cq_);
+    cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+  }
+
+  IoUring(IoUring const &) = delete;
+  IoUring &operator=(IoUring const &) = delete;
+
+  ~IoUring() {
+    munmap(sqes_, sqes_size_);
+    munmap(cq_, cq_size_);
+    munmap(sq_, sq_size_);
+    close(fd_);
+  }
+
+  // whether the kernel provides io_uring, and it is not blocked
+  static bool supported() {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, 1, &params);
+    if (fd < 0) return false;
+    close(fd);
+    return true;
+  }
+
+  // pins the buffers for the *_FIXED operations; false if not permitted,
+  // e.g. by RLIMIT_MEMLOCK
+  bool register_buffers(std::vector<iovec> const &iovs) {
+    return syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS,
+                   iovs.data(), iovs.size()) == 0;
+  }
+
+  // the caller keeps at most `entries` operations in flight
+  void submit(uint8_t opcode, int fd, uint8_t *addr, unsigned len,
+              uint64_t offset, int buf_index, uint64_t user_data) {
+    auto tail = *sq_tail_;
+    auto index = tail & sq_mask_;
+    auto &sqe = sqes_[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = opcode;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<uint64_t>(addr);
+    sqe.len = len;
+    sqe.off = offset;
+    if (buf_index >= 0) sqe.buf_index = buf_index;
+    sqe.user_data = user_data;
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    while (enter(1, 0, 0) < 0) {
+      if (errno != EINTR) throw Error{ErrorType::StdIoError};
+    }
+  }
+
+  // the user_data and result of a finished operation, if any
+  bool peek(std::pair<uint64_t, int32_t> &completion) {
+    auto head = *cq_head_;
+    if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) return false;
+    auto &cqe = cqes_[head & cq_mask_];
+    completion = {cqe.user_data, cqe.res};
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  // waits for an operation to finish
+  std::pair<uint64_t, int32_t> wait() {
+    std::pair<uint64_t, int32_t> completion;
+    while (!peek(completion)) {
+      if (enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+        throw Error{ErrorType::StdIoError};
+      }
+    }
+    return completion;
+  }
+
+ private:
+  int fd_;
+  void *sq_, *cq_;
+  std::size_t sq_size_, cq_size_, sqes_size_;
+  io_uring_sqe *sqes_;
+  unsigned *sq_tail_, *sq_array_, sq_mask_;
+  unsigned *cq_head_, *cq_tail_, cq_mask_;
+  io_uring_cqe *cqes_;
+
+  void *map(std::size_t size, off_t offset) {
+    auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd_, offset);
+    if (ptr == MAP_FAILED) throw Error{ErrorType::StdIoError};
+    return ptr;
+  }
+
+  int enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd_, to_submit, min_complete, flags,
+                   nullptr, 0);
+  }
+};
+
+/**
+ * Buffers of an io_uring reader or writer, registered with the ring when
+ * permitted. Seekable files get `depth` operations in flight at explicit
+ * offsets; anything else (pipes) one at a time, since concurrent operations
+ * at the current position may complete out of order.
+ */
+class UringBuffers {
+ public:
+  UringBuffers(int fd, std::size_t buffer_size, unsigned depth)
+      : fd_{fd},
+        ring_{depth},
+        size_{buffer_size},
+        depth_{depth},
+        in_flight_{0} {
+    auto offset = lseek(fd, 0, SEEK_CUR);
+    // writes to an O_APPEND file land at its end whatever the offset
+    seekable_ = offset >= 0 && (fcntl(fd, F_GETFL) & O_APPEND) == 0;
+    offset_ = seekable_ ? offset : 0;
+    max_in_flight_ = seekable_ ? depth : 1;
+    auto ptr = mmap(nullptr, size_ * depth_, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) throw Error{ErrorType::StdIoError};
+    data_ = static_cast<uint8_t *>(ptr);
+    std::vector<iovec> iovs;
+    for (unsigned i = 0; i < depth_; ++i) iovs.push_back({buffer(i), size_});
+    fixed_ = ring_.register_buffers(iovs);
+    states_.resize(depth_);
+  }
+
+  UringBuffers(UringBuffers const &) = delete;
+  UringBuffers &operator=(UringBuffers const &) = delete;
+
+  ~UringBuffers() { munmap(data_, size_ * depth_); }
+
+  // bytes of buffers, e.g. to charge a MemoryBudget
+  std::size_t capacity() const { return size_ * depth_; }
+
+ protected:
+  enum struct State { Free, InFlight, Ready };
+
+  struct Buffer {
+    State state = State::Free;
+    uint64_t offset = 0;  // of the data in the file, if seekable
+    std::size_t len = 0;  // bytes read or to be written
+    std::size_t done = 0;
+  };
+
+  int fd_;
+  IoUring ring_;
+  std::size_t size_;
+  unsigned depth_, in_flight_, max_in_flight_;
+  bool seekable_, fixed_;
+  uint64_t offset_;
+  uint8_t *data_;
+  std::vector<Buffer> states_;
+
+  uint8_t *buffer(unsigned i) const { return data_ + i * size_; }
+
+  // submits the rest of the operation on buffer i
+  void submit(unsigned i, bool write) {
+    auto &b = states_[i];
+    auto opcode = write ? (fixed_ ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE)
+                        : (fixed_ ? IORING_OP_READ_FIXED : IORING_OP_READ);
+    // -1 is the current position of a non-seekable file
+    auto offset = seekable_ ? b.offset + b.done : static_cast<uint64_t>(-1);
+    ring_.submit(opcode, fd_, buffer(i) + b.done, b.len - b.done, offset,
+                 fixed_ ? static_cast<int>(i) : -1, i);
+    b.state = State::InFlight;
+    ++in_flight_;
+  }
+};
+
+// reads ahead into large buffers with io_uring
+class UringReader : UringBuffers {
+ public:
+  using UringBuffers::capacity;
+
+  explicit UringReader(int fd, std::size_t buffer_size = 1 << 20,
+                       unsigned depth = 4)
+      : UringBuffers{fd, buffer_size, depth},
+        cur_{0},
+        next_{0},
+        pos_{0},
+        eof_{false} {
+    submit_free();
+  }
+
+  std::size_t read(Slice<uint8_t> buf) {
+    std::pair<uint64_t, int32_t> completion;
+    while (ring_.peek(completion)) complete(completion);
+
+    std::size_t n = 0;
+    while (n < buf.size()) {
+      auto &b = states_[cur_];
+      while (b.state == State::InFlight) complete(ring_.wait());
+      if (b.state == State::Free) break;  // EOF
+      auto len = std::min(buf.size() - n, b.done - pos_);
+      std::memcpy(buf.begin() + n, buffer(cur_) + pos_, len);
+      pos_ += len;
+      n += len;
+      if (pos_ == b.done) {
+        b.state = State::Free;
+        pos_ = 0;
+        cur_ = (cur_ + 1) % depth_;
+        submit_free();
+      }
+    }
+    return n;
+  }
+
+ private:
+  unsigned cur_, next_;  // buffers being consumed and to be submitted next
+  std::size_t pos_;      // in the buffer being consumed
+  bool eof_;
+
+  void submit_free() {
+    while (!eof_ && in_flight_ < max_in_flight_ &&
+           states_[next_].state == State::Free) {
+      states_[next_] = Buffer{State::Free, offset_, size_, 0};
+      offset_ += size_;
+      submit(next_, false);
+      next_ = (next_ + 1) % depth_;
+    }
+  }
+
+  void complete(std::pair<uint64_t, int32_t> completion) {
+    auto [i, res] = completion;
+    auto &b = states_[i];
+    --in_flight_;
+    if (res == -EINTR || res == -EAGAIN) {
+      submit(i, false);
+      return;
+    }
+    if (res < 0) throw Error{ErrorType::StdIoError};
+    b.done += res;
+    if (res == 0) {
+      eof_ = true;
+    } else if (seekable_ && b.done < b.len) {
+      // the buffers after this one were submitted at later offsets
+      submit(i, false);
+      return;
+    }
+    b.state = State::Ready;
+    submit_free();
+  }
+};
+
+// copies the output into large buffers whose writes are queued with
+// io_uring without waiting for them; flush() waits for all of them
+class UringWriter : UringBuffers {
+ public:
+  using UringBuffers::capacity;
+
+  explicit UringWriter(int fd, std::size_t buffer_size = 1 << 20,
+                       unsigned depth = 4)
+      : UringBuffers{fd, buffer_size, depth}, cur_{0} {
+    states_[cur_] = Buffer{State::Ready, offset_, 0, 0};
+  }
+
+  ~UringWriter() {
+    try {
+      flush();
+    } catch (Error const &) {
+    }
+  }
+
+  void write(Slice<uint8_t> buf) {
+    auto begin = buf.begin();
+    while (begin < buf.end()) {
+      auto &b = states_[cur_];
+      auto n = std::min<std::size_t>(buf.end() - begin, size_ - b.len);
+      std::memcpy(buffer(cur_) + b.len, begin, n);
+      b.len += n;
+      begin += n;
+      if (b.len == size_) submit_current();
+    }
+  }
+
+  // also moves the file position past the output, which was written at
+  // explicit offsets, for whatever writes to the file next
+  void flush() {
+    if (states_[cur_].len > 0) submit_current();
+    while (in_flight_ > 0) complete(ring_.wait());
+    if (seekable_ && lseek(fd_, offset_, SEEK_SET) < 0) {
+      throw Error{ErrorType::StdIoError};
+    }
+  }
+
+ private:
+  unsigned cur_;  // buffer being filled
+
+  void submit_current() {
+    while (in_flight_ >= max_in_flight_) complete(ring_.wait());
+    submit(cur_, true);
+    offset_ += states_[cur_].len;
+    cur_ = (cur_ + 1) % depth_;
+    while (states_[cur_].state == State::InFlight) complete(ring_.wait());
+    states_[cur_] = Buffer{State::Ready, offset_, 0, 0};
+  }
+
+  void complete(std::pair<uint64_t, int32_t> completion) {
+    auto [i, res] = completion;
+    auto &b = states_[i];
+    --in_flight_;
+    if (res < 0 && res != -EINTR && res != -EAGAIN) {
+      throw Error{ErrorType::StdIoError};
+    }
+    if (res > 0) b.done += res;
+    if (b.done < b.len) {
+      submit(i, true);
+    } else {
+      b.state = State::Free;
+    }
+  }
+};
+#endif
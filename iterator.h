@@ -2,11 +2,21 @@
 
 #include <optional>
 
+#include "slice.h"
+
 template <typename T>
 struct Iterator {
   using Item = T;
 
-  virtual std::optional<T> next() = 0;
+  // fills up to items.size() items and returns the number filled;
+  // returns 0 only when the iterator is exhausted
+  virtual std::size_t next_batch(Slice<T> items) = 0;
+
+  std::optional<T> next() {
+    T item;
+    if (next_batch(Slice{&item, &item + 1}) == 0) return std::nullopt;
+    return item;
+  }
 
   virtual ~Iterator() = default;
 };
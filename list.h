@@ -0,0 +1,156 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bitreader.h"
+#include "producer.h"
+
+// enough for the header of the first member unless its name is huge
+constexpr std::size_t HEAD_READ_SIZE = 64 << 10;
+
+// what --list reports about an input
+struct Listing {
+  Header header;  // of the first member
+  uint64_t compressed, size;
+  std::size_t members;
+  const char *method;  // how the sizes were found
+};
+
+// counts the bytes read, for inputs whose size is not known up front
+template <typename Read>
+struct CountingReader {
+  Read &reader;
+  uint64_t count;
+
+  std::size_t read(Slice<uint8_t> buf) {
+    auto n = reader.read(buf);
+    count += n;
+    return n;
+  }
+};
+
+// the BSIZE subfield ("BC") of a BGZF extra field: the member size minus one
+inline std::optional<std::size_t> bgzf_block_size(Slice<uint8_t> extra) {
+  std::size_t i = 0;
+  while (i + 4 <= extra.size()) {
+    std::size_t len = extra[i + 2] | extra[i + 3] << 8;
+    if (extra[i] == 'B' && extra[i + 1] == 'C' && len == 2 &&
+        i + 6 <= extra.size()) {
+      return extra[i + 4] | extra[i + 5] << 8;
+    }
+    i += 4 + len;
+  }
+  return std::nullopt;
+}
+
+// size of the BGZF member whose header starts head; nullopt if it does not
+// carry one, or head is too short to tell
+inline std::optional<uint64_t> bgzf_member_size(Slice<uint8_t> head) {
+  if (head.size() < 12 || head[0] != ID1 || head[1] != ID2 ||
+      head[2] != DEFLATE || (head[3] & FEXTRA) == 0) {
+    return std::nullopt;
+  }
+  std::size_t xlen = head[10] | head[11] << 8;
+  if (12 + xlen > head.size()) return std::nullopt;
+  auto bsize =
+      bgzf_block_size(Slice{head.begin() + 12, head.begin() + 12 + xlen});
+  if (!bsize) return std::nullopt;
+  return *bsize + 1;
+}
+
+// adds the rest of the input to listing, skip-decoding every member
+template <typename Read>
+void scan(Read &reader, Listing &listing) {
+  Producer<Read> producer{reader};
+  while (auto member = producer.skip_member()) {
+    if (static_cast<uint32_t>(member->size) != member->footer.size) {
+      throw Error{ErrorType::SizeMismatch};
+    }
+    if (listing.members++ == 0) listing.header = std::move(member->header);
+    listing.size += member->size;
+  }
+}
+
+// lists an input that can only be read through
+template <typename Read>
+Listing list_stream(Read &reader) {
+  CountingReader<Read> counter{reader, 0};
+  Listing listing{Header{}, 0, 0, 0, "scan"};
+  scan(counter, listing);
+  listing.compressed = counter.count;
+  return listing;
+}
+
+/**
+ * Lists a regular file without decompressing it. A BGZF file is walked
+ * from member to member with a pread each, using the member sizes in their
+ * headers. Other files get their size from the trailer, as with gzip -l:
+ * that is the size of the last member only, modulo 4 GiB, and it is
+ * reported as one member whatever precedes it. With scan, and from the
+ * first BGZF member that does not carry its size on, the members are
+ * skip-decoded instead, which gives exact sizes and member counts.
+ */
+inline Listing list_file(int fd, bool scan_all) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) throw Error{ErrorType::StdIoError};
+  uint64_t file_size = st.st_size;
+  if (file_size == 0) throw Error{ErrorType::EmptyInput};
+
+  // the first header, including its name
+  std::vector<uint8_t> buf(std::min<uint64_t>(file_size, HEAD_READ_SIZE));
+  if (pread(fd, buf.data(), buf.size(), 0) !=
+      static_cast<ssize_t>(buf.size())) {
+    throw Error{ErrorType::StdIoError};
+  }
+  MemoryReader head{buf.data(), buf.data() + buf.size()};
+  BitReader<MemoryReader> head_reader{head};
+  Listing listing{read_header(head_reader), file_size, 0, 0, "bgzf"};
+  if (file_size < 18) throw Error{ErrorType::UnexpectedEof};
+
+  std::optional<uint64_t> member_size;
+  if (!scan_all && listing.header.extra_field) {
+    auto bsize = bgzf_block_size(Slice{*listing.header.extra_field});
+    if (bsize) member_size = *bsize + 1;
+  }
+  if (!scan_all && !member_size) {
+    uint8_t trailer[8];
+    if (pread(fd, trailer, 8, file_size - 8) != 8) {
+      throw Error{ErrorType::StdIoError};
+    }
+    MemoryReader reader{trailer, std::end(trailer)};
+    listing.size = read_footer(reader).size;
+    listing.members = 1;
+    listing.method = "trailer";
+    return listing;
+  }
+
+  // the trailer of a member and the head of the next one, in one pread
+  uint64_t offset = 0;
+  while (member_size) {
+    auto end = offset + *member_size;
+    if (*member_size < 18 || end > file_size) {
+      throw Error{ErrorType::UnexpectedEof};
+    }
+    uint8_t next[8 + 64];
+    auto n = std::min<uint64_t>(sizeof(next), file_size - end + 8);
+    if (pread(fd, next, n, end - 8) != static_cast<ssize_t>(n)) {
+      throw Error{ErrorType::StdIoError};
+    }
+    MemoryReader reader{next, next + 8};
+    listing.size += read_footer(reader).size;
+    ++listing.members;
+    offset = end;
+    if (offset == file_size) return listing;
+    member_size = bgzf_member_size(Slice{next + 8, next + n});
+  }
+
+  listing.method = offset > 0 ? "bgzf+scan" : "scan";
+  if (lseek(fd, offset, SEEK_SET) < 0) throw Error{ErrorType::StdIoError};
+  MappedFile in{fd};
+  scan(in, listing);
+  return listing;
+}
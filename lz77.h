@@ -9,6 +9,9 @@ constexpr uint16_t MAX_LENGTH = 258;
 
 constexpr uint32_t END_OF_BLOCK = 256;
 
+// more than the longest code with its extra bits, rounded up to peek_bits()
+constexpr std::size_t MAX_CODE_BYTES = 8;
+
 constexpr std::pair<uint32_t, uint32_t> SYMBOL2BITS_LENGTH[] = {
     {0, 0},   {0, 3},   {0, 4},   {0, 5},   {0, 6},   {0, 7},
     {0, 8},   {0, 9},   {0, 10},  {1, 11},  {1, 13},  {1, 15},
@@ -51,9 +54,14 @@ struct DecodeResult {
   static DecodeResult WindowIsFull(std::size_t n) { return {n, false}; }
 };
 
+// forced inline, like the bit reader and decoder calls under it: the whole
+// program is one translation unit, and once its inlining budget runs out
+// (skip() for --list was enough) decode() calls them out of line at a fifth
+// of the throughput
 template <typename BitRead>
-inline Code read_next_code(BitRead& reader, HuffmanDecoder const& ll_decoder,
-                           HuffmanDecoder const& dist_decoder) {
+__attribute__((always_inline)) inline Code read_next_code(
+    BitRead& reader, HuffmanDecoder const& ll_decoder,
+    HuffmanDecoder const& dist_decoder) {
   auto bitcode = reader.peek_bits();
   uint32_t symbol, len;
   std::tie(symbol, len) = ll_decoder.decode(bitcode);
@@ -76,10 +84,13 @@ inline Code read_next_code(BitRead& reader, HuffmanDecoder const& ll_decoder,
   }
 }
 
+// if streaming, returns what was decoded as soon as the reader runs out of
+// buffered input instead of waiting for more in the middle of the block
 template <typename BitRead>
 DecodeResult decode(Slice<uint8_t> window, std::size_t boundary,
                     BitRead& reader, HuffmanDecoder const& ll_decoer,
-                    HuffmanDecoder const& dist_decoder) {
+                    HuffmanDecoder const& dist_decoder,
+                    bool streaming = false) {
   auto idx = boundary;
   if (idx + MAX_LENGTH >= window.size()) {
     return DecodeResult::WindowIsFull(idx - boundary);
@@ -110,6 +121,30 @@ DecodeResult decode(Slice<uint8_t> window, std::size_t boundary,
     if (idx + MAX_LENGTH >= window.size()) {
       return DecodeResult::WindowIsFull(idx - boundary);
     }
+    if (streaming && reader.buffered() < MAX_CODE_BYTES) {
+      return DecodeResult::WindowIsFull(idx - boundary);
+    }
   }
   throw Error{ErrorType::EndOfBlockNotFound};
 }
+
+// decodes the rest of a block only to count its bytes: nothing is written
+// and back-references are neither resolved nor checked
+template <typename BitRead>
+std::size_t skip(BitRead& reader, HuffmanDecoder const& ll_decoder,
+                 HuffmanDecoder const& dist_decoder) {
+  std::size_t n = 0;
+  for (;;) {
+    auto code = read_next_code(reader, ll_decoder, dist_decoder);
+    switch (code.index()) {
+      case 0:  // Literal
+        ++n;
+        break;
+      case 1:  // EndOfBlock
+        return n;
+      case 2:  // Dictionary
+        n += std::get<2>(code).length;
+        break;
+    }
+  }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "slice.h"
+
+/**
+ * Regular output file that is decoded into directly: it is extended and
+ * mapped ahead of the decoder, so back-references read the output itself
+ * and no write syscalls are needed. finish() trims it to the bytes written.
+ */
+class MappedOutput {
+ public:
+  // fd must be open for reading and writing; size_hint is the expected size
+  explicit MappedOutput(int fd, std::size_t size_hint = 0)
+      : fd_{fd}, data_{nullptr}, size_{0}, capacity_{0} {
+    reserve(size_hint);
+  }
+
+  MappedOutput(MappedOutput const &) = delete;
+  MappedOutput &operator=(MappedOutput const &) = delete;
+
+  ~MappedOutput() {
+    if (data_) munmap(data_, capacity_);
+  }
+
+  uint8_t *data() const { return data_; }
+
+  // bytes written so far
+  std::size_t size() const { return size_; }
+
+  std::size_t capacity() const { return capacity_; }
+
+  // makes room for n more bytes; the mapping may move
+  void reserve(std::size_t n) {
+    if (size_ + n <= capacity_) return;
+    auto capacity = std::max({size_ + n, capacity_ * 2, MIN_CAPACITY});
+    if (!extend(capacity)) throw Error{ErrorType::StdIoError};
+    void *ptr;
+#ifdef __linux__
+    ptr = data_ ? mremap(data_, capacity_, capacity, MREMAP_MAYMOVE)
+                : mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       fd_, 0);
+#else
+    if (data_) munmap(data_, capacity_);
+    ptr = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+#endif
+    if (ptr == MAP_FAILED) {
+      data_ = nullptr;
+      throw Error{ErrorType::StdIoError};
+    }
+    data_ = static_cast<uint8_t *>(ptr);
+#ifdef MADV_POPULATE_WRITE
+    // one call instead of a page fault per page; best effort
+    madvise(data_ + capacity_, capacity - capacity_, MADV_POPULATE_WRITE);
+#endif
+    capacity_ = capacity;
+  }
+
+  // marks n bytes after size() as written
+  void commit(std::size_t n) { size_ += n; }
+
+  void finish() {
+    if (data_) munmap(data_, capacity_);
+    data_ = nullptr;
+    capacity_ = 0;
+    if (ftruncate(fd_, size_) != 0) throw Error{ErrorType::StdIoError};
+  }
+
+ private:
+  static constexpr std::size_t MIN_CAPACITY = 1 << 20;
+
+  bool extend(std::size_t size) {
+#ifdef __linux__
+    // allocating the blocks up front makes the page faults cheaper
+    if (fallocate(fd_, 0, 0, size) == 0) return true;
+#endif
+    return ftruncate(fd_, size) == 0;
+  }
+
+  int fd_;
+  uint8_t *data_;
+  std::size_t size_, capacity_;
+};
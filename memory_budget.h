@@ -0,0 +1,123 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+
+/**
+ * Accounts for the bytes held by the decoder against an optional limit.
+ *
+ * Long-lived buffers (window, bit reader buffer, output buffer) are charged
+ * and never block. Chunks in flight between the producer and the consumer
+ * are acquired and released; acquire() blocks while the budget is exhausted
+ * so that a fast producer waits for a slow consumer. It never blocks when
+ * nothing is in flight, so a limit below the fixed footprint cannot
+ * deadlock, it merely serializes the threads.
+ */
+class MemoryBudget {
+ public:
+  explicit MemoryBudget(
+      std::size_t limit = std::numeric_limits<std::size_t>::max())
+      : limit_{limit}, used_{0}, peak_{0}, in_flight_{0} {}
+
+  MemoryBudget(MemoryBudget const &) = delete;
+  MemoryBudget &operator=(MemoryBudget const &) = delete;
+
+  void charge(std::size_t n) {
+    std::lock_guard lock{lock_};
+    add(n);
+  }
+
+  void discharge(std::size_t n) {
+    std::lock_guard lock{lock_};
+    used_ -= n;
+    cv_.notify_all();
+  }
+
+  // waits until n bytes fit in the budget or cancelled() returns true;
+  // returns false without acquiring anything if cancelled
+  template <typename Cancelled>
+  bool acquire(std::size_t n, Cancelled cancelled) {
+    std::unique_lock lock{lock_};
+    cv_.wait(lock, [&] {
+      return used_ + n <= limit_ || in_flight_ == 0 || cancelled();
+    });
+    if (used_ + n > limit_ && in_flight_ > 0) return false;
+    add(n);
+    in_flight_ += n;
+    return true;
+  }
+
+  // acquires n bytes if acquire() would not block
+  bool try_acquire(std::size_t n) {
+    std::lock_guard lock{lock_};
+    if (used_ + n > limit_ && in_flight_ > 0) return false;
+    add(n);
+    in_flight_ += n;
+    return true;
+  }
+
+  void release(std::size_t n) {
+    std::lock_guard lock{lock_};
+    used_ -= n;
+    in_flight_ -= n;
+    cv_.notify_all();
+  }
+
+  // wakes up blocked acquire() calls so that they re-check cancellation
+  void wake() {
+    std::lock_guard lock{lock_};
+    cv_.notify_all();
+  }
+
+  std::size_t limit() const { return limit_; }
+
+  std::size_t peak() const {
+    std::lock_guard lock{lock_};
+    return peak_;
+  }
+
+ private:
+  std::size_t limit_;
+  std::size_t used_, peak_, in_flight_;
+  mutable std::mutex lock_;
+  std::condition_variable cv_;
+
+  void add(std::size_t n) {
+    used_ += n;
+    peak_ = std::max(peak_, used_);
+  }
+};
+
+// charges a fixed-size allocation for as long as this object lives
+class Charge {
+ public:
+  Charge() : budget_{nullptr}, n_{0} {}
+
+  explicit Charge(MemoryBudget *budget, std::size_t n)
+      : budget_{budget}, n_{n} {
+    if (budget_) budget_->charge(n_);
+  }
+
+  Charge(Charge const &) = delete;
+  Charge &operator=(Charge const &) = delete;
+
+  Charge(Charge &&other) noexcept : budget_{other.budget_}, n_{other.n_} {
+    other.budget_ = nullptr;
+  }
+
+  Charge &operator=(Charge &&other) noexcept {
+    std::swap(budget_, other.budget_);
+    std::swap(n_, other.n_);
+    return *this;
+  }
+
+  ~Charge() {
+    if (budget_) budget_->discharge(n_);
+  }
+
+ private:
+  MemoryBudget *budget_;
+  std::size_t n_;
+};
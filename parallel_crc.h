@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "slice.h"
+#ifdef USE_FAST_CRC32
+#include "Crc32.h"
+#else
+#include "zlib.h"
+#endif
+
+/**
+ * Computes the CRC32 of a sequence of chunks on a pool of worker threads.
+ *
+ * Each chunk is checksummed independently and the results are merged in
+ * submission order with crc32_combine, so the caller only pays for queuing.
+ * Chunks may be submitted from any order-preserving source, e.g. the
+ * consumer of a pipelined or parallel decoder. Up to two pieces per worker
+ * are queued or being checksummed; beyond that submit() waits, so that the
+ * data kept alive for the workers stays bounded.
+ */
+class ParallelCrc32 {
+ public:
+  explicit ParallelCrc32(std::size_t num_threads)
+      : max_pending_{2 * num_threads * PIECE_SIZE},
+        pending_{0},
+        crc32_{0},
+        begin_{0},
+        stop_{false} {
+    for (std::size_t i = 0; i < num_threads; ++i) {
+      workers_.emplace_back([this] { work(); });
+    }
+  }
+
+  ParallelCrc32(ParallelCrc32 const &) = delete;
+  ParallelCrc32 &operator=(ParallelCrc32 const &) = delete;
+
+  ~ParallelCrc32() {
+    {
+      std::lock_guard lock{lock_};
+      stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto &worker : workers_) worker.join();
+  }
+
+  // queues data; it must stay valid until wait() returns, or as long as
+  // owner is alive if one is given
+  void submit(Slice<uint8_t> data, std::shared_ptr<const void> owner = {}) {
+    std::unique_lock lock{lock_};
+    // a chunk larger than the bound only waits for the queue to empty
+    room_cv_.wait(lock, [this, &data] {
+      return pending_ == 0 || pending_ + data.size() <= max_pending_;
+    });
+    pending_ += data.size();
+    for (auto begin = data.begin(); begin < data.end(); begin += PIECE_SIZE) {
+      auto end = begin + std::min<std::size_t>(PIECE_SIZE, data.end() - begin);
+      jobs_.push_back(Job{begin_ + pieces_.size(), Slice{begin, end}, owner});
+      pieces_.push_back(Piece{0, static_cast<std::size_t>(end - begin), false});
+    }
+    work_cv_.notify_all();
+  }
+
+  // waits for everything submitted and returns the CRC32 of it all
+  uint32_t wait() {
+    std::unique_lock lock{lock_};
+    done_cv_.wait(lock, [this] { return pieces_.empty(); });
+    return crc32_;
+  }
+
+  // waits for everything submitted and starts a new checksum, continuing
+  // from crc32 if given
+  void reset(uint32_t crc32 = 0) {
+    wait();
+    crc32_ = crc32;
+  }
+
+ private:
+  // pieces are large enough that crc32_combine is cheap in comparison
+  static constexpr std::size_t PIECE_SIZE = 256 << 10;
+
+  struct Job {
+    std::size_t seq;
+    Slice<uint8_t> data;
+    std::shared_ptr<const void> owner;
+  };
+
+  struct Piece {
+    uint32_t crc32;
+    std::size_t size;
+    bool done;
+  };
+
+  std::size_t max_pending_;
+  std::size_t pending_;       // bytes submitted but not checksummed yet
+  uint32_t crc32_;            // of the merged pieces
+  std::size_t begin_;         // sequence number of pieces_.front()
+  std::deque<Piece> pieces_;  // not yet merged, in order
+  std::deque<Job> jobs_;
+  bool stop_;
+  std::mutex lock_;
+  std::condition_variable work_cv_, done_cv_, room_cv_;
+  std::vector<std::thread> workers_;
+
+  void work() {
+    std::unique_lock lock{lock_};
+    for (;;) {
+      work_cv_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+      if (jobs_.empty()) return;
+      auto job = std::move(jobs_.front());
+      jobs_.pop_front();
+
+      lock.unlock();
+#ifdef USE_FAST_CRC32
+      auto crc = crc32_fast(job.data.begin(), job.data.size(), 0);
+#else
+      auto crc = crc32(0, job.data.begin(), job.data.size());
+#endif
+      job.owner.reset();
+      lock.lock();
+      pending_ -= job.data.size();
+      room_cv_.notify_all();
+
+      pieces_[job.seq - begin_].crc32 = crc;
+      pieces_[job.seq - begin_].done = true;
+      while (!pieces_.empty() && pieces_.front().done) {
+        auto &piece = pieces_.front();
+        crc32_ = crc32_combine(crc32_, piece.crc32, piece.size);
+        pieces_.pop_front();
+        ++begin_;
+      }
+      if (pieces_.empty()) done_cv_.notify_all();
+    }
+  }
+};
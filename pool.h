@@ -0,0 +1,244 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "push.h"
+
+/**
+ * Decodes many independent streams on a fixed set of worker threads. The
+ * input of each stream is fed as it arrives; a stream with input is queued,
+ * and a worker decodes up to quantum bytes of its output before putting it
+ * at the back of the queue, so that a large stream cannot hold a worker
+ * while others wait. Streams that have not output anything yet go first
+ * and for a single drain, which bounds the wait for their first output. A
+ * stream left without input for idle_timeout is suspended down to its live
+ * window; one that is fed again sooner keeps its tables.
+ *
+ * The callbacks of a stream are called on the workers, one at a time, and
+ * must not throw.
+ */
+class DecompressorPool {
+ public:
+  using Id = uint64_t;
+  // the next piece of output, valid during the call only
+  using OnOutput = std::function<void(Slice<uint8_t>)>;
+  // once per stream, when it is fully decoded after close() or fails; null
+  // on success
+  using OnDone = std::function<void(std::exception_ptr)>;
+
+  explicit DecompressorPool(
+      std::size_t workers, std::size_t quantum = 256 << 10,
+      MemoryBudget *budget = nullptr,
+      std::chrono::milliseconds idle_timeout = std::chrono::milliseconds{10})
+      : quantum_{quantum},
+        budget_{budget},
+        idle_timeout_{idle_timeout},
+        next_id_{0},
+        stop_{false} {
+    for (std::size_t i = 0; i < std::max<std::size_t>(workers, 1); ++i) {
+      workers_.emplace_back([this] { run(); });
+    }
+  }
+
+  DecompressorPool(DecompressorPool const &) = delete;
+  DecompressorPool &operator=(DecompressorPool const &) = delete;
+
+  // streams that are still open are dropped without a callback
+  ~DecompressorPool() {
+    {
+      std::lock_guard lock{lock_};
+      stop_ = true;
+    }
+    ready_.notify_all();
+    for (auto &worker : workers_) worker.join();
+  }
+
+  Id open(OnOutput on_output, OnDone on_done) {
+    auto stream = std::make_unique<Stream>(budget_);
+    stream->on_output = std::move(on_output);
+    stream->on_done = std::move(on_done);
+    std::lock_guard lock{lock_};
+    auto id = stream->id = next_id_++;
+    streams_.emplace(id, std::move(stream));
+    return id;
+  }
+
+  // the input is copied; ignored once the stream has failed
+  void feed(Id id, Slice<uint8_t const> input) {
+    std::lock_guard lock{lock_};
+    auto it = streams_.find(id);
+    if (it == streams_.end()) return;
+    auto &stream = *it->second;
+    stream.input.insert(stream.input.end(), input.begin(), input.end());
+    schedule(stream);
+  }
+
+  // no more input for the stream
+  void close(Id id) {
+    std::lock_guard lock{lock_};
+    auto it = streams_.find(id);
+    if (it == streams_.end()) return;
+    it->second->closed = true;
+    schedule(*it->second);
+  }
+
+  // waits until every stream opened so far is done
+  void wait() {
+    std::unique_lock lock{lock_};
+    done_.wait(lock, [this] { return streams_.empty(); });
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr std::size_t OUTPUT_SIZE = 64 << 10;  // of a drain
+  // the first output of a stream waits for this much output of each stream
+  // queued before it
+  static constexpr std::size_t FIRST_QUANTUM = 16 << 10;
+
+  struct Stream {
+    Id id;
+    PushDecompressor decompressor;
+    OnOutput on_output;
+    OnDone on_done;
+    std::vector<uint8_t> input;  // fed but not passed to the decoder yet
+    uint64_t output;             // bytes handed to on_output so far
+    bool closed, queued, running;
+    bool idle;  // waiting for input since idle_since, not suspended yet
+    Clock::time_point idle_since;
+
+    explicit Stream(MemoryBudget *budget)
+        : id{0},
+          decompressor{budget},
+          output{0},
+          closed{false},
+          queued{false},
+          running{false},
+          idle{false} {}
+  };
+
+  std::size_t quantum_;
+  MemoryBudget *budget_;
+  Clock::duration idle_timeout_;
+  Id next_id_;
+  bool stop_;
+  std::unordered_map<Id, std::unique_ptr<Stream>> streams_;
+  std::deque<Stream *> fresh_;  // queued before their first output
+  std::deque<Stream *> queue_;
+  // when streams went idle, oldest first; an entry is stale if the stream
+  // has been scheduled since
+  std::deque<std::pair<Id, Clock::time_point>> idle_;
+  std::mutex lock_;
+  std::condition_variable ready_, done_;
+  std::vector<std::thread> workers_;
+
+  // with the lock held; a running stream is requeued by its worker
+  void schedule(Stream &stream) {
+    if (stream.queued || stream.running) return;
+    stream.queued = true;
+    stream.idle = false;
+    (stream.output == 0 ? fresh_ : queue_).push_back(&stream);
+    ready_.notify_one();
+  }
+
+  // with the lock held, which is released while suspending
+  void suspend_idle(std::unique_lock<std::mutex> &lock) {
+    auto now = Clock::now();
+    while (!idle_.empty() && idle_.front().second + idle_timeout_ <= now) {
+      auto [id, since] = idle_.front();
+      idle_.pop_front();
+      auto it = streams_.find(id);
+      if (it == streams_.end()) continue;
+      auto &stream = *it->second;
+      if (!stream.idle || stream.idle_since != since) continue;
+      stream.idle = false;
+      stream.running = true;
+      lock.unlock();
+      stream.decompressor.suspend();
+      lock.lock();
+      stream.running = false;
+      if (!stream.input.empty() || stream.closed) schedule(stream);
+    }
+  }
+
+  void run() {
+    std::vector<uint8_t> output(OUTPUT_SIZE);
+    std::vector<uint8_t> input;
+    std::unique_lock lock{lock_};
+    for (;;) {
+      if (stop_) return;
+      if (fresh_.empty() && queue_.empty()) {
+        if (idle_.empty()) {
+          ready_.wait(lock);
+        } else if (ready_.wait_until(lock, idle_.front().second +
+                                               idle_timeout_) ==
+                   std::cv_status::timeout) {
+          suspend_idle(lock);
+        }
+        continue;
+      }
+      auto &from = fresh_.empty() ? queue_ : fresh_;
+      auto stream = from.front();
+      from.pop_front();
+      stream->queued = false;
+      stream->running = true;
+      input.swap(stream->input);
+      auto closed = stream->closed;
+      lock.unlock();
+
+      auto done = false;
+      std::exception_ptr error;
+      auto status = PushStatus::NeedsInput;
+      try {
+        stream->decompressor.feed(Slice{input});
+        input.clear();
+        // until its first output, a stream gets a single short drain
+        auto quantum = stream->output == 0 ? FIRST_QUANTUM : quantum_;
+        Slice buf{output.data(),
+                  output.data() + std::min(quantum, output.size())};
+        std::size_t n = 0;
+        do {
+          auto result = stream->decompressor.drain(buf);
+          if (result.n > 0) {
+            stream->on_output(Slice{buf.begin(), buf.begin() + result.n});
+          }
+          n += result.n;
+          status = result.status;
+        } while (status == PushStatus::HasOutput && n < quantum);
+        stream->output += n;
+        if (closed && status == PushStatus::NeedsInput) {
+          throw Error{ErrorType::UnexpectedEof};
+        }
+        done = closed && status == PushStatus::Done;
+      } catch (...) {
+        error = std::current_exception();
+        input.clear();
+        done = true;
+      }
+      if (done) stream->on_done(error);
+
+      lock.lock();
+      stream->running = false;
+      if (done) {
+        streams_.erase(stream->id);
+        if (streams_.empty()) done_.notify_all();
+      } else if (status == PushStatus::HasOutput || !stream->input.empty() ||
+                 stream->closed) {
+        schedule(*stream);
+      } else {
+        stream->idle = true;
+        stream->idle_since = Clock::now();
+        idle_.emplace_back(stream->id, stream->idle_since);
+      }
+    }
+  }
+};
@@ -1,13 +1,18 @@
 #pragma once
 
+#include <utility>
 #include <variant>
 
+#include "arena.h"
 #include "bitreader.h"
+#include "checkpoint.h"
 #include "codebook.h"
 #include "footer.h"
 #include "header.h"
 #include "huffman_decoder.h"
 #include "lz77.h"
+#include "mapped_output.h"
+#include "memory_budget.h"
 #include "sliding_window.h"
 
 enum struct State {
@@ -16,17 +21,355 @@ enum struct State {
   Inflate,
   InflateFinalBlock,
   Footer,
+  // only between items while streaming, with part of a stored block left
+  Stored,
+  StoredFinalBlock,
 };
 
+// window followed by the literal/length and distance tables of the current
+// block. The code length table is built in their place before them, and the
+// fixed tables are shared, so two tables are the most that are live.
+constexpr std::size_t ARENA_SIZE =
+    WINDOW_SIZE + (max_lookup_size(MAX_LL_SYMBOL) +
+                   max_lookup_size(MAX_DIST_SYMBOL)) *
+                      sizeof(std::pair<uint32_t, uint32_t>);
+
+// free space kept ahead of the decoder when writing into a MappedOutput
+constexpr std::size_t OUTPUT_RESERVE = 1 << 20;
+
+// free space inflate() makes in the window before decoding into it
+constexpr std::size_t MIN_INFLATE_ROOM = MAX_DISTANCE;
+
+// largest chunk a run of stored blocks is merged into by next_batch(); larger
+// chunks cost more in page faults than they save per item
+constexpr std::size_t MAX_STORED_RUN = 256 << 10;
+
+constexpr std::size_t MAX_STORED_BLOCK = (1 << 16) - 1;
+
+// arenas of suspended producers kept for the next ones to resume; enough
+// for the workers of a DecompressorPool to pass them around
+constexpr std::size_t MAX_POOLED_ARENAS = 16;
+
+inline ArenaPool &arena_pool(bool huge_pages) {
+  static ArenaPool pool{ARENA_SIZE, false, MAX_POOLED_ARENAS};
+  static ArenaPool huge_pool{ARENA_SIZE, true, MAX_POOLED_ARENAS};
+  return huge_pages ? huge_pool : pool;
+}
+
+// the fixed Huffman tables never change, so all producers share one copy
+inline std::pair<HuffmanDecoder, HuffmanDecoder> const &fixed_decoders() {
+  // the codes are at most 9 bits long, so there are no secondary tables
+  static Arena arena{((1 << 9) + (1 << 5)) *
+                     sizeof(std::pair<uint32_t, uint32_t>)};
+  static auto const decoders =
+      std::make_pair(HuffmanDecoder{Codebook::default_ll(), arena},
+                     HuffmanDecoder{Codebook::default_dist(), arena});
+  return decoders;
+}
+
 using Produce = std::variant<Header, Footer, std::vector<uint8_t>>;
 
+// same as Produce but the data is a view into the producer's buffers that
+// remains valid until the next call to the producer
+using ProduceView = std::variant<Header, Footer, Slice<uint8_t>>;
+
+// a member read by Producer::skip_member()
+struct MemberSummary {
+  Header header;
+  uint64_t size;  // of the output
+  Footer footer;
+};
+
+// bytes of output data held by the item; headers and footers are negligible
+inline std::size_t footprint(Produce const &produce) {
+  if (auto xs = std::get_if<2>(&produce)) return xs->capacity();
+  return 0;
+}
+
 template <typename Read>
 class Producer : public Iterator<Produce> {
  public:
-  explicit Producer(Read &reader)
-      : reader_{reader}, state_{State::Header}, member_idx_{0} {}
+  explicit Producer(Read &reader, MemoryBudget *budget = nullptr,
+                    bool huge_pages = false)
+      : reader_{reader},
+        state_{State::Header},
+        member_idx_{0},
+        huge_pages_{huge_pages},
+        arena_{ARENA_SIZE, huge_pages},
+        window_{arena_.allocate<uint8_t>(WINDOW_SIZE)},
+        block_mark_{arena_.mark()},
+        hlit_{0},
+        hdist_{0},
+        pending_{0},
+        output_{nullptr},
+        member_begin_{0},
+        streaming_{false},
+        max_chunk_{0},
+        stored_left_{0},
+        stored_tail_{nullptr, nullptr},
+        stored_block_{false},
+        suspended_{false},
+        budget_{budget},
+        charge_{budget, arena_.capacity() + reader_.capacity()} {}
+
+  std::size_t next_batch(Slice<Produce> items) override {
+    std::size_t n = 0;
+    for (auto &item : items) {
+      auto view = next_view();
+      if (!view) break;
+      switch (view->index()) {
+        case 0:
+          item = std::move(std::get<0>(*view));
+          break;
+        case 1:
+          item = std::get<1>(*view);
+          break;
+        case 2: {
+          auto xs = std::get<2>(*view);
+          std::vector<uint8_t> data;
+          // a run of stored blocks goes out as one chunk
+          if (stored_block_ && next_is_stored()) data.reserve(MAX_STORED_RUN);
+          data.assign(xs.begin(), xs.end());
+          while (stored_block_ &&
+                 data.size() + MAX_STORED_BLOCK <= MAX_STORED_RUN &&
+                 next_is_stored()) {
+            xs = std::get<2>(*next_view());
+            data.insert(data.end(), xs.begin(), xs.end());
+          }
+          item = std::move(data);
+          break;
+        }
+      }
+      ++n;
+    }
+    return n;
+  }
+
+  // produces the next item without copying the data out of the window
+  std::optional<ProduceView> next_view() {
+    if (suspended_) resume();
+    advance();
+    return step();
+  }
 
-  std::optional<Produce> next() override {
+  /**
+   * Reads the next member without producing its output: the blocks are
+   * decoded only to count their bytes, so neither the window nor the output
+   * is written. Must be called between members; nullopt at the end.
+   */
+  std::optional<MemberSummary> skip_member() {
+    if (suspended_) resume();
+    advance();
+    assert(state_ == State::Header);
+    if (!reader_.has_data_left()) {
+      if (member_idx_ == 0) throw Error{ErrorType::EmptyInput};
+      return std::nullopt;
+    }
+    ++member_idx_;
+    MemberSummary member{read_header(reader_), 0, Footer{}};
+    for (auto is_final = false; !is_final;) {
+      auto header = reader_.read_bits(3);
+      is_final = (header & 1) == 1;
+      switch (header & 0b110) {
+        case 0b000: {
+          auto len = stored_length();
+          window_.reserve(len);
+          member.size += stored_payload(len, window_.write_buffer()).size();
+          break;
+        }
+        case 0b010:
+          member.size += skip(reader_, fixed_decoders().first,
+                              fixed_decoders().second);
+          break;
+        case 0b100:
+          read_dynamic_code_lengths();
+          std::tie(ll_decoder_, dist_decoder_) = block_decoders();
+          member.size += skip(reader_, ll_decoder_, dist_decoder_);
+          break;
+        default:
+          throw Error{ErrorType::InvalidBlockType};
+      }
+    }
+    member.footer = read_footer(reader_);
+    return member;
+  }
+
+  /**
+   * Decodes straight into output from the next member on, instead of into
+   * the window; views then point into the output. Back-references are
+   * resolved against the output written since the start of the member.
+   */
+  void write_to(MappedOutput &output) {
+    advance();
+    output_ = &output;
+    member_begin_ = output.size();
+  }
+
+  /**
+   * Hands out the output decoded so far whenever the input runs dry instead
+   * of waiting for more in the middle of a block, and in chunks of at most
+   * about max_chunk bytes (0: up to a window). For inputs that arrive in
+   * pieces, e.g. from a socket.
+   */
+  void stream(std::size_t max_chunk = 0) {
+    streaming_ = true;
+    max_chunk_ = max_chunk;
+  }
+
+  // starts over on a new input, reusing all buffers
+  void reset(Read &reader) {
+    if (suspended_) resume();
+    reader_.reset(reader);
+    state_ = State::Header;
+    member_idx_ = 0;
+    window_.reset();
+    pending_ = 0;
+    output_ = nullptr;
+    stored_tail_ = Slice<uint8_t>{nullptr, nullptr};
+  }
+
+  /**
+   * Shrinks an idle producer down to its unread input, the live part of the
+   * window and the code lengths of the current block. The arena with the
+   * window and the Huffman tables goes back to arena_pool(); the next call
+   * takes one from there again and rebuilds the tables from the code
+   * lengths.
+   */
+  void suspend() {
+    if (suspended_) return;
+    advance();
+    flush_stored_tail();
+    auto history = window_.history();
+    saved_window_.assign(history.begin(), history.end());
+    arena_pool(huge_pages_).give(std::exchange(arena_, Arena{0}));
+    window_ = SlidingWindow{Slice<uint8_t>{nullptr, nullptr}};
+    ll_decoder_ = dist_decoder_ = HuffmanDecoder{};
+    reader_.suspend();
+    charge_ = Charge{budget_, saved_window_.size() + reader_.capacity()};
+    suspended_ = true;
+  }
+
+  // where the producer is between two items; see mark()
+  struct Mark {
+    State state;
+    std::size_t member_idx;
+    uint64_t window_end;  // counting the history dropped from the window
+    std::size_t stored_left;
+    std::pair<uint64_t, uint32_t> position;  // in the input
+  };
+
+  /**
+   * For inputs that may run dry before the end, such as PushReader: an
+   * item that fails for lack of input may have changed the state, so the
+   * caller takes a mark before each item and rewinds to it to retry once
+   * more input is there. The reader must be rewound to mark.position too.
+   * Not for readers with view().
+   */
+  Mark mark() {
+    if (suspended_) resume();
+    advance();
+    return Mark{state_, member_idx_, window_.cur + window_.dropped,
+                stored_left_, reader_.position()};
+  }
+
+  void rewind(Mark const &mark) {
+    state_ = mark.state;
+    member_idx_ = mark.member_idx;
+    // the item may have made room in the window, but wrote nothing yet
+    window_.cur = mark.window_end - window_.dropped;
+    stored_left_ = mark.stored_left;
+    pending_ = 0;
+    reader_.seek(mark.position.first, mark.position.second);
+  }
+
+  // the state between two items; not in write_to() mode
+  void save(Checkpoint &checkpoint) {
+    assert(!output_);
+    if (suspended_) resume();
+    advance();
+    flush_stored_tail();
+    std::tie(checkpoint.input_offset, checkpoint.input_bits) =
+        reader_.position();
+    checkpoint.state = static_cast<uint32_t>(state_);
+    checkpoint.member_idx = member_idx_;
+    checkpoint.hlit = hlit_;
+    checkpoint.hdist = hdist_;
+    checkpoint.code_lengths.assign(&code_lengths_[0],
+                                   &code_lengths_[hlit_ + hdist_]);
+    auto history = window_.history();
+    checkpoint.window.assign(history.begin(), history.end());
+  }
+
+  // continues from a checkpoint; the reader must be at its input offset
+  void restore(Checkpoint const &checkpoint) {
+    if (suspended_) resume();
+    if (checkpoint.state > static_cast<uint32_t>(State::Footer) ||
+        checkpoint.window.size() > MAX_DISTANCE ||
+        checkpoint.input_bits > 7 ||
+        checkpoint.code_lengths.size() != checkpoint.hlit + checkpoint.hdist ||
+        checkpoint.code_lengths.size() > std::size(code_lengths_)) {
+      throw Error{ErrorType::InvalidCheckpoint};
+    }
+    reader_.seek(checkpoint.input_offset, checkpoint.input_bits);
+    state_ = static_cast<State>(checkpoint.state);
+    member_idx_ = checkpoint.member_idx;
+    pending_ = 0;
+    std::copy(checkpoint.window.begin(), checkpoint.window.end(),
+              window_.data.begin());
+    window_.cur = checkpoint.window.size();
+    hlit_ = checkpoint.hlit;
+    hdist_ = checkpoint.hdist;
+    std::copy(checkpoint.code_lengths.begin(), checkpoint.code_lengths.end(),
+              code_lengths_);
+    if (state_ == State::Inflate || state_ == State::InflateFinalBlock) {
+      std::tie(ll_decoder_, dist_decoder_) = block_decoders();
+    }
+  }
+
+  void resume() {
+    if (!suspended_) return;
+    reader_.resume();
+    arena_ = arena_pool(huge_pages_).take();
+    window_ = SlidingWindow{arena_.allocate<uint8_t>(WINDOW_SIZE)};
+    std::copy(saved_window_.begin(), saved_window_.end(),
+              window_.data.begin());
+    window_.cur = saved_window_.size();
+    saved_window_ = std::vector<uint8_t>{};
+    block_mark_ = arena_.mark();
+    if (state_ == State::Inflate || state_ == State::InflateFinalBlock) {
+      std::tie(ll_decoder_, dist_decoder_) = block_decoders();
+    }
+    charge_ = Charge{budget_, arena_.capacity() + reader_.capacity()};
+    suspended_ = false;
+  }
+
+ private:
+  BitReader<Read> reader_;
+  State state_;
+  std::size_t member_idx_;
+  bool huge_pages_;
+  Arena arena_;
+  SlidingWindow window_;
+  std::size_t block_mark_;  // arena_ is rewound here for every block
+  HuffmanDecoder ll_decoder_;
+  HuffmanDecoder dist_decoder_;
+  // code lengths of the current block; hlit_ is 0 for the fixed codes
+  uint8_t code_lengths_[MAX_LL_SYMBOL + 32];
+  std::size_t hlit_, hdist_;
+  std::size_t pending_;  // bytes handed out in a view but not yet slid
+  MappedOutput *output_;      // replaces the window if set
+  std::size_t member_begin_;  // offset of the current member in output_
+  bool streaming_;
+  std::size_t max_chunk_;
+  std::size_t stored_left_;     // of the current stored block
+  Slice<uint8_t> stored_tail_;  // history not yet copied into the window
+  bool stored_block_;  // whether the last view was a stored block
+  bool suspended_;
+  std::vector<uint8_t> saved_window_;  // live window while suspended
+  MemoryBudget *budget_;
+  Charge charge_;
+
+  std::optional<ProduceView> step() {
     switch (state_) {
       case State::Header:
         if (!reader_.has_data_left()) {
@@ -44,15 +387,17 @@ class Producer : public Iterator<Produce> {
 
         switch (header & 0b110) {
           case 0b000:
-            if (is_final) state_ = State::Footer;
+            stored_left_ = stored_length();
+            state_ = is_final ? State::StoredFinalBlock : State::Stored;
             return inflate_block0();
           case 0b010:
-            ll_decoder_ = HuffmanDecoder{Codebook::default_ll()};
-            dist_decoder_ = HuffmanDecoder{Codebook::default_dist()};
+            hlit_ = 0;
+            std::tie(ll_decoder_, dist_decoder_) = fixed_decoders();
             state_ = is_final ? State::InflateFinalBlock : State::Inflate;
             return inflate(is_final);
           case 0b100:
-            std::tie(ll_decoder_, dist_decoder_) = read_dynamic_codebook();
+            read_dynamic_code_lengths();
+            std::tie(ll_decoder_, dist_decoder_) = block_decoders();
             state_ = is_final ? State::InflateFinalBlock : State::Inflate;
             return inflate(is_final);
           default:
@@ -63,56 +408,171 @@ class Producer : public Iterator<Produce> {
         return inflate(false);
       case State::InflateFinalBlock:
         return inflate(true);
+      case State::Stored:
+      case State::StoredFinalBlock:
+        return inflate_block0();
       case State::Footer:
         state_ = State::Header;
-        window_ = SlidingWindow{}; // reset history
+        // reset history
+        window_.reset();
+        stored_tail_ = Slice<uint8_t>{nullptr, nullptr};
+        if (output_) member_begin_ = output_->size();
         return read_footer(reader_);
       default:
         return std::nullopt;  // unreachable
     }
   }
 
- private:
-  BitReader<Read> reader_;
-  State state_;
-  std::size_t member_idx_;
-  SlidingWindow window_;
-  HuffmanDecoder ll_decoder_;
-  HuffmanDecoder dist_decoder_;
-
-  Produce inflate_block0() {
+  // reads the LEN and NLEN of a stored block
+  std::size_t stored_length() {
     reader_.byte_align();
     auto len = reader_.read_bits(16);
     auto nlen = reader_.read_bits(16);
     if ((len ^ nlen) != 0xFFFF) {
       throw Error{ErrorType::BlockType0LenMismatch};
     }
-    std::vector<uint8_t> buf(len, 0);
-    auto gcount = reader_.read(Slice{buf});
-    if (gcount != len) throw Error{ErrorType::UnexpectedEof};
-    auto n = std::min<std::size_t>(len, MAX_DISTANCE);
-    auto write_buffer = window_.write_buffer();
-    std::copy(&buf[len - n], &buf[len], write_buffer.begin());
-    window_.slide(n);
+    return len;
+  }
+
+  // the payload of a stored block: in place if the whole input is in
+  // memory, otherwise read into buf, which must be large enough
+  Slice<uint8_t> stored_payload(std::size_t len, Slice<uint8_t> buf) {
+    if constexpr (has_view<Read>::value) {
+      buf = reader_.read_view(len);
+    } else {
+      assert(len <= buf.size());
+      buf = Slice{buf.begin(), buf.begin() + reader_.read(Slice{
+                                                 buf.begin(),
+                                                 buf.begin() + len})};
+    }
+    if (buf.size() != len) throw Error{ErrorType::UnexpectedEof};
     return buf;
   }
 
-  Produce inflate(bool is_final) {
+  /**
+   * The payload never goes through an intermediate buffer: it is handed out
+   * in place if the input is in memory, and otherwise read straight into
+   * the window (or the output), which always has room for a whole block.
+   * Only the history the next block may refer to is copied into the window,
+   * and only once a compressed block follows, so a run of stored blocks
+   * costs no copy at all.
+   */
+  ProduceView inflate_block0() {
+    stored_block_ = true;
+    auto next =
+        state_ == State::StoredFinalBlock ? State::Footer : State::Block;
+    if constexpr (!has_view<Read>::value) {
+      if (streaming_ && !output_) {
+        // whatever part of the block has arrived
+        if (stored_left_ > 0 && !reader_.has_data_left()) {
+          throw Error{ErrorType::UnexpectedEof};
+        }
+        auto n = std::min(stored_left_, reader_.buffered());
+        window_.reserve(n);
+        auto buf = stored_payload(n, window_.write_buffer());
+        stored_left_ -= n;
+        if (stored_left_ == 0) state_ = next;
+        pending_ = n;
+        return buf;
+      }
+    }
+    auto len = stored_left_;
+    stored_left_ = 0;
+    state_ = next;
+    if (output_) {
+      output_->reserve(len);
+      auto begin = output_->data() + output_->size();
+      auto buf = stored_payload(len, Slice{begin, begin + len});
+      if (buf.begin() != begin) std::copy(buf.begin(), buf.end(), begin);
+      pending_ = len;
+      return Slice{begin, begin + len};
+    }
+    if constexpr (has_view<Read>::value) {
+      auto buf = stored_payload(len, Slice<uint8_t>{nullptr, nullptr});
+      if (len >= MAX_DISTANCE) {
+        // the history is all in this block, which stays valid in the input
+        stored_tail_ = Slice{buf.end() - MAX_DISTANCE, buf.end()};
+      } else {
+        flush_stored_tail();
+        window_.reserve(len);
+        std::copy(buf.begin(), buf.end(), window_.write_buffer().begin());
+        window_.slide(len);
+      }
+      return buf;
+    } else {
+      // slid on the next call, like the output of inflate()
+      window_.reserve(len);
+      auto buf = stored_payload(len, window_.write_buffer());
+      pending_ = len;
+      return buf;
+    }
+  }
+
+  bool next_is_stored() {
+    return state_ == State::Block && (reader_.peek_bits() & 0b110) == 0;
+  }
+
+  // copies the history left in the input by inflate_block0() into the window
+  void flush_stored_tail() {
+    if (stored_tail_.empty()) return;
+    window_.reserve(stored_tail_.size());
+    std::copy(stored_tail_.begin(), stored_tail_.end(),
+              window_.write_buffer().begin());
+    window_.slide(stored_tail_.size());
+    stored_tail_ = Slice<uint8_t>{nullptr, nullptr};
+  }
+
+  ProduceView inflate(bool is_final) {
+    stored_block_ = false;
+    flush_stored_tail();
+    window_.reserve(MIN_INFLATE_ROOM);
+    auto buffer = window_.buffer();
     auto boundary = window_.boundary();
-    auto result =
-        decode(window_.buffer(), boundary, reader_, ll_decoder_, dist_decoder_);
+    if (output_) {
+      output_->reserve(OUTPUT_RESERVE);
+      buffer = Slice{output_->data() + member_begin_,
+                     output_->data() + output_->capacity()};
+      boundary = output_->size() - member_begin_;
+    }
+    if (max_chunk_ > 0 && boundary + max_chunk_ + MAX_LENGTH < buffer.size()) {
+      buffer = Slice{buffer.begin(), buffer.begin() + boundary + max_chunk_ +
+                                          MAX_LENGTH};
+    }
+    auto result = decode(buffer, boundary, reader_, ll_decoder_,
+                         dist_decoder_, streaming_);
     auto n = result.n;
     if (result.done) {
       state_ = is_final ? State::Footer : State::Block;
     }
-    auto begin = window_.data.begin() + window_.cur;
-    std::vector<uint8_t> buf(begin, begin + n);
-    window_.slide(n);
+    // slid on the next call so that the view stays valid until then
+    pending_ = n;
+    auto begin = buffer.begin() + boundary;
+    return Slice{begin, begin + n};
+  }
+
+  // moves past the data handed out in the last view
+  void advance() {
+    if (output_) {
+      output_->commit(pending_);
+    } else {
+      window_.slide(pending_);
+    }
+    pending_ = 0;
+  }
 
-    return buf;
+  // builds the decoders of the current block from its code lengths
+  std::pair<HuffmanDecoder, HuffmanDecoder> block_decoders() {
+    if (hlit_ == 0) return fixed_decoders();
+    arena_.rewind(block_mark_);
+    uint32_t lengths[MAX_LL_SYMBOL + 32];
+    std::copy(&code_lengths_[0], &code_lengths_[hlit_ + hdist_], lengths);
+    Codebook ll_codes{Slice{&lengths[0], &lengths[hlit_]}};
+    Codebook dist_codes{Slice{&lengths[hlit_], &lengths[hlit_ + hdist_]}};
+    return std::make_pair(HuffmanDecoder{ll_codes, arena_},
+                          HuffmanDecoder{dist_codes, arena_});
   }
 
-  std::pair<HuffmanDecoder, HuffmanDecoder> read_dynamic_codebook() {
+  void read_dynamic_code_lengths() {
     std::size_t hlit = reader_.read_bits(5) + 257;
     std::size_t hdist = reader_.read_bits(5) + 1;
     std::size_t hclen = reader_.read_bits(4) + 4;
@@ -125,20 +585,23 @@ class Producer : public Iterator<Produce> {
       cl_lengths[indices[i]] = reader_.read_bits(3);
     }
     Codebook cl_codes{Slice{cl_lengths, std::end(cl_lengths)}};
-    HuffmanDecoder cl_decoder{cl_codes};
+    arena_.rewind(block_mark_);
+    HuffmanDecoder cl_decoder{cl_codes, arena_};
 
     auto num_codes = hlit + hdist;
-    std::vector<uint32_t> lengths;
-    lengths.reserve(num_codes);
-    while (lengths.size() < num_codes) {
+    auto &lengths = code_lengths_;  // hlit + hdist is at most 320
+    std::size_t n = 0;
+    while (n < num_codes) {
       uint32_t cl_code, len;
+      auto bits = reader_.peek_bits();
       try {
-        std::tie(cl_code, len) = cl_decoder.decode(reader_.peek_bits());
+        std::tie(cl_code, len) = cl_decoder.decode(bits);
       } catch (std::exception &e) {
         throw Error{ErrorType::ReadDynamicCodebook};
       }
       reader_.consume(len);
       std::size_t length;
+      uint8_t x = 0;
       switch (cl_code) {
         case 0:
         case 1:
@@ -156,32 +619,28 @@ class Producer : public Iterator<Produce> {
         case 13:
         case 14:
         case 15:
-          lengths.push_back(cl_code);
-          break;
-        case 16: {
-          assert(!lengths.empty());
+          lengths[n++] = cl_code;
+          continue;
+        case 16:
+          assert(n > 0);
           length = 3 + reader_.read_bits(2);
-          auto x = lengths.back();
-          lengths.resize(lengths.size() + length, x);
+          x = lengths[n - 1];
           break;
-        }
         case 17:
           length = 3 + reader_.read_bits(3);
-          lengths.resize(lengths.size() + length, 0);
           break;
         case 18:
           length = 11 + reader_.read_bits(7);
-          lengths.resize(lengths.size() + length, 0);
           break;
         default:
           throw Error{ErrorType::ReadDynamicCodebook};
       }
+      if (n + length > num_codes) throw Error{ErrorType::ReadDynamicCodebook};
+      std::fill(&lengths[n], &lengths[n + length], x);
+      n += length;
     }
 
-    if (lengths.size() != num_codes)
-      throw Error{ErrorType::ReadDynamicCodebook};
-    Codebook ll_codes{Slice{&lengths[0], &lengths[hlit]}};
-    Codebook dist_codes{Slice{&lengths[hlit], &lengths[lengths.size()]}};
-    return std::make_pair(HuffmanDecoder{ll_codes}, HuffmanDecoder{dist_codes});
+    hlit_ = hlit;
+    hdist_ = hdist;
   }
 };
\ No newline at end of file
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <vector>
+
+#include "producer.h"
+#ifdef USE_FAST_CRC32
+#include "Crc32.h"
+#else
+#include "zlib.h"
+#endif
+
+/**
+ * Input that is fed in pieces, e.g. from event loop callbacks. read()
+ * returns 0 when it runs dry, and starved() tells so; the bytes from the
+ * last release() on are kept so that the reader can be rewound over them.
+ */
+class PushReader {
+ public:
+  PushReader() : base_{0}, pos_{0}, released_{0}, starved_{false} {}
+
+  void feed(Slice<uint8_t const> input) {
+    // drop released bytes once they make up most of the buffer
+    auto released = released_ - base_;
+    if (released > 0 && released >= buf_.size() / 2) {
+      buf_.erase(buf_.begin(), buf_.begin() + released);
+      base_ = released_;
+    }
+    buf_.insert(buf_.end(), input.begin(), input.end());
+  }
+
+  std::size_t read(Slice<uint8_t> buf) {
+    auto begin = buf_.begin() + (pos_ - base_);
+    auto n = std::min<std::size_t>(buf.size(), buf_.end() - begin);
+    std::copy(begin, begin + n, buf.begin());
+    pos_ += n;
+    if (n == 0) starved_ = true;
+    return n;
+  }
+
+  // input offset of the next read
+  uint64_t offset() const { return pos_; }
+
+  // bytes fed but not read yet
+  std::size_t available() const { return buf_.size() - (pos_ - base_); }
+
+  // whether a read found nothing since the last call to clear()
+  bool starved() const { return starved_; }
+
+  void clear() { starved_ = false; }
+
+  // rewinds to an offset at or after the last release()
+  void rewind(uint64_t offset) { pos_ = offset; }
+
+  // the bytes before offset will not be read again
+  void release(uint64_t offset) { released_ = offset; }
+
+ private:
+  std::vector<uint8_t> buf_;
+  uint64_t base_;  // input offset of buf_[0]
+  uint64_t pos_;
+  uint64_t released_;
+  bool starved_;
+};
+
+enum struct PushStatus {
+  NeedsInput,  // feed() more
+  HasOutput,   // the buffer was filled; drain() again
+  Done,        // at the end of a member with no input left
+};
+
+struct DrainResult {
+  std::size_t n;  // bytes written
+  PushStatus status;
+};
+
+/**
+ * Push-mode decoder for event loops: the caller feeds compressed input as
+ * it arrives and drains the output, and neither call blocks or needs a
+ * thread. When the input runs dry in the middle of a header or a block,
+ * the producer is rewound to the start of that item and drain() returns
+ * NeedsInput; blocks are decoded in streaming mode so that this rarely
+ * throws away more than a few codes. Checksum errors are thrown as usual.
+ */
+class PushDecompressor {
+ public:
+  explicit PushDecompressor(MemoryBudget *budget = nullptr)
+      : producer_{reader_, budget},
+        chunk_{nullptr, nullptr},
+        in_member_{false},
+        members_{0},
+        crc32_{0},
+        size_{0} {
+    producer_.stream();
+  }
+
+  // the input is copied
+  void feed(Slice<uint8_t const> input) { reader_.feed(input); }
+
+  // frees the window and the tables of an idle stream, after drain()
+  // returned NeedsInput; the next drain() reallocates them
+  void suspend() { producer_.suspend(); }
+
+  DrainResult drain(Slice<uint8_t> buf) {
+    std::size_t n = 0;
+    for (;;) {
+      auto len = std::min(buf.size() - n, chunk_.size());
+      copy_and_checksum(buf.begin() + n, chunk_.begin(), len);
+      chunk_ = Slice{chunk_.begin() + len, chunk_.end()};
+      n += len;
+      if (!chunk_.empty()) return {n, PushStatus::HasOutput};
+
+      auto mark = producer_.mark();
+      reader_.release(mark.position.first);
+      reader_.clear();
+      std::optional<ProduceView> view;
+      try {
+        view = producer_.next_view();
+      } catch (Error const &e) {
+        if (!reader_.starved() || (e.type() != ErrorType::UnexpectedEof &&
+                                   e.type() != ErrorType::EmptyInput)) {
+          throw;
+        }
+      }
+      if (reader_.starved() || !view) {
+        producer_.rewind(mark);
+        reader_.rewind(mark.position.first);
+        auto done = !in_member_ && reader_.available() == 0 && members_ > 0;
+        return {n, done ? PushStatus::Done : PushStatus::NeedsInput};
+      }
+      switch (view->index()) {
+        case 0:  // Header
+          in_member_ = true;
+          break;
+        case 1: {  // Footer
+          auto &footer = std::get<1>(*view);
+          if (crc32_ != footer.crc32) throw Error{ErrorType::ChecksumMismatch};
+          if (size_ != footer.size) throw Error{ErrorType::SizeMismatch};
+          crc32_ = 0;
+          size_ = 0;
+          in_member_ = false;
+          ++members_;
+          break;
+        }
+        case 2:  // Data
+          chunk_ = std::get<2>(*view);
+          size_ += chunk_.size();
+          break;
+      }
+    }
+  }
+
+ private:
+  PushReader reader_;
+  Producer<PushReader> producer_;
+  Slice<uint8_t> chunk_;  // output not drained yet
+  bool in_member_;
+  std::size_t members_;
+  uint32_t crc32_;
+  uint32_t size_;
+
+  void copy_and_checksum(uint8_t *dst, const uint8_t *src, std::size_t n) {
+#ifdef USE_FAST_CRC32
+    crc32_ = crc32_copy(dst, src, n, crc32_);
+#else
+    std::copy(src, src + n, dst);
+    crc32_ = crc32(crc32_, dst, n);
+#endif
+  }
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "slice.h"
+
+/**
+ * Reads the input on a background thread into a ring of large buffers, so
+ * that the decoder only waits for I/O when the device is slower than
+ * inflate. wait_time() tells how long read() blocked on the reader thread.
+ *
+ * Errors thrown by the underlying reader are rethrown by read(). The
+ * destructor joins the thread, so it waits for a pending read to return.
+ */
+template <typename Read>
+class ReadAhead {
+ public:
+  explicit ReadAhead(Read &reader, std::size_t buffer_size = 4 << 20,
+                     std::size_t count = 3)
+      : buffers_(std::max<std::size_t>(count, 2),
+                 std::vector<uint8_t>(buffer_size)),
+        lens_(buffers_.size()),
+        head_{0},
+        filled_{0},
+        pos_{0},
+        reading_{false},
+        eof_{false},
+        stop_{false},
+        wait_time_{0} {
+    thread_ = std::thread{[this, &reader] { run(reader); }};
+  }
+
+  ReadAhead(ReadAhead const &) = delete;
+  ReadAhead &operator=(ReadAhead const &) = delete;
+
+  ~ReadAhead() {
+    {
+      std::lock_guard lock{lock_};
+      stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+
+  std::size_t read(Slice<uint8_t> buf) {
+    std::size_t n = 0;
+    while (n < buf.size()) {
+      if (!reading_ && !next()) break;
+      auto &buffer = buffers_[head_];
+      auto len = std::min(buf.size() - n, lens_[head_] - pos_);
+      std::memcpy(buf.begin() + n, buffer.data() + pos_, len);
+      pos_ += len;
+      n += len;
+      if (pos_ == lens_[head_]) release();
+    }
+    return n;
+  }
+
+  // time read() spent waiting for the input
+  std::chrono::nanoseconds wait_time() const { return wait_time_; }
+
+  std::size_t capacity() const {
+    return buffers_.size() * buffers_[0].size();
+  }
+
+ private:
+  std::vector<std::vector<uint8_t>> buffers_;
+  std::vector<std::size_t> lens_;
+  std::size_t head_;    // buffer being read from
+  std::size_t filled_;  // buffers filled by the thread, from head_ on
+  std::size_t pos_;     // in the buffer being read from
+  bool reading_;        // whether head_ is being read from
+  bool eof_, stop_;
+  std::exception_ptr error_;
+  std::chrono::nanoseconds wait_time_;
+  std::mutex lock_;
+  std::condition_variable cv_;
+  std::thread thread_;
+
+  // waits for the next filled buffer; false at the end of the input
+  bool next() {
+    std::unique_lock lock{lock_};
+    if (filled_ == 0 && !eof_ && !error_) {
+      auto start = std::chrono::steady_clock::now();
+      cv_.wait(lock, [this] { return filled_ > 0 || eof_ || error_; });
+      wait_time_ += std::chrono::steady_clock::now() - start;
+    }
+    if (filled_ > 0) {
+      reading_ = true;
+      pos_ = 0;
+      return true;
+    }
+    if (error_) std::rethrow_exception(error_);
+    return false;
+  }
+
+  void release() {
+    std::lock_guard lock{lock_};
+    head_ = (head_ + 1) % buffers_.size();
+    --filled_;
+    reading_ = false;
+    cv_.notify_all();
+  }
+
+  void run(Read &reader) {
+    std::unique_lock lock{lock_};
+    for (;;) {
+      cv_.wait(lock, [this] { return filled_ < buffers_.size() || stop_; });
+      if (stop_) return;
+      auto tail = (head_ + filled_) % buffers_.size();
+      lock.unlock();
+
+      std::size_t n = 0;
+      try {
+        n = reader.read(Slice{buffers_[tail]});
+      } catch (...) {
+        lock.lock();
+        error_ = std::current_exception();
+        cv_.notify_all();
+        return;
+      }
+
+      lock.lock();
+      lens_[tail] = n;
+      if (n > 0) {
+        ++filled_;
+      } else {
+        eof_ = true;
+      }
+      cv_.notify_all();
+      if (eof_) return;
+    }
+  }
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <type_traits>
 #include <vector>
 
 template <typename T>
@@ -9,6 +10,11 @@ class Slice {
 
   explicit Slice(std::vector<T>& xs) : begin_{&xs[0]}, end_{&xs[xs.size()]} {}
 
+  // a Slice<U> is also a Slice<U const>
+  template <typename U,
+            typename = std::enable_if_t<std::is_same_v<U const, T>>>
+  Slice(Slice<U> xs) : begin_{xs.begin()}, end_{xs.end()} {}
+
   std::size_t size() const { return end_ - begin_; }
 
   bool empty() const { return size() == 0; }
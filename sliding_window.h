@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cassert>
 #include <cstring>
 
 #include "slice.h"
@@ -8,25 +9,41 @@ constexpr uint16_t MAX_DISTANCE = 1 << 15;
 constexpr std::size_t WINDOW_SIZE = static_cast<std::size_t>(MAX_DISTANCE) * 3;
 
 struct SlidingWindow {
-  std::vector<uint8_t> data;
+  Slice<uint8_t> data;  // WINDOW_SIZE bytes owned by the caller
   std::size_t cur;
+  uint64_t dropped;  // bytes of history discarded by reserve() so far
 
-  explicit SlidingWindow() : data(WINDOW_SIZE, 0), cur{0} {}
+  explicit SlidingWindow(Slice<uint8_t> data)
+      : data{data}, cur{0}, dropped{0} {}
 
-  auto buffer() { return Slice{&data[0], &data[data.size()]}; }
+  auto buffer() { return data; }
 
-  auto write_buffer() { return Slice{&data[cur], &data[data.size()]}; }
+  auto write_buffer() { return Slice{data.begin() + cur, data.end()}; }
 
-  void slide(std::size_t n) {
-    auto end = cur + n;
-    if (end > MAX_DISTANCE) {
-      auto delta = end - MAX_DISTANCE;
-      std::memmove(&data[0], &data[delta], end - delta);
-      cur = MAX_DISTANCE;
-    } else {
-      cur = end;
-    }
+  // n more bytes were written at cur
+  void slide(std::size_t n) { cur += n; }
+
+  // makes room for n more bytes, at most WINDOW_SIZE - MAX_DISTANCE, by
+  // moving the last MAX_DISTANCE bytes to the front. Done only once the
+  // space runs out, so that small writes do not each move the history.
+  void reserve(std::size_t n) {
+    assert(n <= WINDOW_SIZE - MAX_DISTANCE);
+    if (cur + n <= data.size()) return;
+    auto delta = cur - MAX_DISTANCE;
+    std::memmove(&data[0], &data[delta], MAX_DISTANCE);
+    cur = MAX_DISTANCE;
+    dropped += delta;
+  }
+
+  // the last MAX_DISTANCE bytes at most
+  Slice<uint8_t> history() {
+    auto begin = cur > MAX_DISTANCE ? cur - MAX_DISTANCE : 0;
+    return Slice{data.begin() + begin, data.begin() + cur};
   }
 
+  // forgets the history; no need to clear the data since back-references
+  // are checked against the boundary
+  void reset() { cur = 0; }
+
   std::size_t boundary() const { return cur; }
 };
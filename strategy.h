@@ -0,0 +1,112 @@
+#pragma once
+
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "decompressor.h"
+#include "io.h"
+#include "list.h"
+
+// below this, starting a second thread costs more than it overlaps
+constexpr uint64_t SMALL_INPUT = 1 << 20;
+// from this on, both modes are timed on the start of the input, which then
+// costs a few percent of the run at most
+constexpr uint64_t WARMUP_MIN_INPUT = 64 << 20;
+constexpr std::size_t WARMUP_SIZE = 4 << 20;
+
+// what --auto looks at
+struct InputProfile {
+  bool seekable;
+  uint64_t size;  // compressed; 0 unless seekable
+  bool bgzf;      // the first member carries its size
+  unsigned cores;
+};
+
+struct Strategy {
+  bool multithread;
+  std::string reason;
+};
+
+inline InputProfile profile_input(int fd, unsigned cores) {
+  InputProfile profile{false, 0, false, cores};
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) return profile;
+  profile.seekable = true;
+  profile.size = st.st_size;
+  uint8_t head[64];
+  auto n = pread(fd, head, sizeof(head), lseek(fd, 0, SEEK_CUR));
+  profile.bgzf = n > 0 && bgzf_member_size(Slice{head, head + n}).has_value();
+  return profile;
+}
+
+// seconds to decode the first WARMUP_SIZE bytes of the output of a regular
+// file, including starting and stopping the decoder
+inline double time_warmup(int fd, bool multithread) {
+  std::vector<uint8_t> buffer(64 << 10);
+  auto start = std::chrono::steady_clock::now();
+  {
+    MappedFile in{fd};
+    Decompressor decompressor{in, multithread};
+    for (std::size_t n = 0; n < WARMUP_SIZE;) {
+      auto len = decompressor.read(Slice{buffer});
+      if (len == 0) break;
+      n += len;
+    }
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+/**
+ * Picks between the single-thread decoder, which reads a regular file in
+ * place, and the two-thread pipeline, which overlaps reading and decoding
+ * with copying the output out. Large regular files are decided by timing
+ * both on the start of the input. The layout is only reported: every
+ * member is decoded in order either way.
+ */
+inline Strategy choose_strategy(InputProfile const &profile, int fd,
+                                bool mapped_output) {
+  if (profile.cores < 2) return {false, "there is a single core"};
+  if (mapped_output) {
+    return {false, "the output file is decoded into on one thread"};
+  }
+  if (!profile.seekable) {
+    return {true, "the input is a pipe, so reading it overlaps decoding"};
+  }
+  if (profile.size < SMALL_INPUT) {
+    return {false, "the input is too small to amortize a second thread"};
+  }
+  if (profile.size < WARMUP_MIN_INPUT) {
+    return {true, "the input is mid-sized and there are cores to spare"};
+  }
+  double single, pipelined;
+  try {
+    single = time_warmup(fd, false);
+    pipelined = time_warmup(fd, true);
+  } catch (Error const &) {
+    // the real run reports it
+    return {false, "the warm-up failed"};
+  }
+  std::ostringstream reason;
+  reason << "warm-up on " << (WARMUP_SIZE >> 20) << " MiB took "
+         << single * 1e3 << " ms on one thread, " << pipelined * 1e3
+         << " ms on two";
+  return {pipelined < single, reason.str()};
+}
+
+inline std::string describe(InputProfile const &profile) {
+  std::ostringstream out;
+  if (profile.seekable) {
+    out << profile.size << " bytes, " << (profile.bgzf ? "BGZF" : "gzip");
+  } else {
+    out << "pipe";
+  }
+  out << ", " << profile.cores << (profile.cores == 1 ? " core" : " cores");
+  return out.str();
+}
@@ -0,0 +1,114 @@
+// C++20: AsyncDecompressor over a source that suspends on every read and is
+// resumed from an event loop
+
+#include <deque>
+#include <iostream>
+#include <optional>
+
+#include "async.h"
+#include "gzip_fixture.h"
+
+#ifndef __cpp_impl_coroutine
+#error "async_test needs coroutines"
+#endif
+
+std::deque<std::coroutine_handle<>> ready;
+
+// hands out at most piece bytes per read, each after a trip through ready
+struct Source {
+  std::vector<uint8_t> const &data;
+  std::size_t piece, pos;
+
+  struct Read {
+    Source &source;
+    Slice<uint8_t> buf;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+      ready.push_back(handle);
+    }
+    std::size_t await_resume() {
+      auto n = std::min({buf.size(), source.piece,
+                         source.data.size() - source.pos});
+      std::copy(source.data.begin() + source.pos,
+                source.data.begin() + source.pos + n, buf.begin());
+      source.pos += n;
+      return n;
+    }
+  };
+
+  Read read(Slice<uint8_t> buf) { return Read{*this, buf}; }
+};
+
+// starts right away and is never awaited
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+struct Result {
+  std::vector<uint8_t> output;
+  std::optional<ErrorType> error;
+  bool done = false;
+};
+
+Detached decode(Source &source, Result &result) {
+  AsyncDecompressor<Source> decompressor{source, 4096};
+  std::vector<uint8_t> buf(10000);
+  try {
+    while (auto n = co_await decompressor.read(Slice{buf})) {
+      result.output.insert(result.output.end(), buf.begin(), buf.begin() + n);
+    }
+  } catch (Error const &e) {
+    result.error = e.type();
+  }
+  result.done = true;
+}
+
+Result run(std::vector<uint8_t> const &input, std::size_t piece) {
+  Source source{input, piece, 0};
+  Result result;
+  decode(source, result);
+  while (!ready.empty()) {
+    auto handle = ready.front();
+    ready.pop_front();
+    handle.resume();
+  }
+  return result;
+}
+
+int main() {
+  int failures = 0;
+  auto check = [&](bool ok, char const *what) {
+    if (!ok) {
+      std::cerr << "FAILED: " << what << "\n";
+      ++failures;
+    }
+  };
+
+  // two members, with stored and fixed-Huffman blocks
+  auto first = sample_data(300000), second = sample_data(70000);
+  auto input = gzip_member(first, 30000);
+  auto member = gzip_member(second);
+  input.insert(input.end(), member.begin(), member.end());
+  auto expected = first;
+  expected.insert(expected.end(), second.begin(), second.end());
+
+  for (std::size_t piece : {7, 777, 1 << 20}) {
+    auto result = run(input, piece);
+    check(result.done && !result.error && result.output == expected,
+          "output");
+  }
+
+  auto truncated = run(std::vector<uint8_t>(input.begin(), input.end() - 5),
+                       1000);
+  check(truncated.error == ErrorType::UnexpectedEof, "truncated");
+  auto empty = run({}, 1000);
+  check(empty.error == ErrorType::EmptyInput, "empty");
+  return failures == 0 ? 0 : 1;
+}
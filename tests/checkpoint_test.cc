@@ -0,0 +1,113 @@
+// --checkpoint and --resume: the output left by an earlier run is
+// truncated, whether a checkpoint is resumed from or not, and a checkpoint
+// is only resumed on the input it was taken on
+
+#include <cstdlib>
+#include <iostream>
+
+#include "checkpoint.h"
+#include "decompressor.h"
+#include "gzip_fixture.h"
+#include "io.h"
+
+namespace {
+
+int temp_file(std::vector<uint8_t> const &contents) {
+  char path[] = "/tmp/checkpoint_test.XXXXXX";
+  auto fd = mkstemp(path);
+  if (fd < 0) throw Error{ErrorType::StdIoError};
+  unlink(path);
+  if (write(fd, contents.data(), contents.size()) !=
+          static_cast<ssize_t>(contents.size()) ||
+      lseek(fd, 0, SEEK_SET) != 0) {
+    throw Error{ErrorType::StdIoError};
+  }
+  return fd;
+}
+
+// decodes from in into out, at most limit bytes; returns the checkpoint
+// after the last view
+Checkpoint run(int in, int out, std::optional<Checkpoint> const &checkpoint,
+               uint64_t limit) {
+  seek_to(checkpoint, in, out);
+  MappedFile reader{in};
+  Decompressor decompressor{reader, false};
+  if (checkpoint) decompressor.restore(*checkpoint);
+  auto offset = checkpoint ? checkpoint->output_offset : 0;
+  while (offset < limit) {
+    auto xs = decompressor.read_view();
+    if (xs.empty()) break;
+    if (write(out, xs.begin(), xs.size()) !=
+        static_cast<ssize_t>(xs.size())) {
+      throw Error{ErrorType::StdIoError};
+    }
+    offset += xs.size();
+  }
+  auto state = decompressor.checkpoint();
+  state.output_offset = offset;
+  state.input = stamp_input(in);
+  return state;
+}
+
+bool output_is(int out, std::vector<uint8_t> const &data) {
+  struct stat st;
+  if (fstat(out, &st) != 0 ||
+      static_cast<std::size_t>(st.st_size) != data.size()) {
+    return false;
+  }
+  std::vector<uint8_t> xs(data.size());
+  return pread(out, xs.data(), xs.size(), 0) ==
+             static_cast<ssize_t>(xs.size()) &&
+         xs == data;
+}
+
+}  // namespace
+
+int main() {
+  auto data = sample_data(1 << 20);
+  auto in = temp_file(gzip_member(data));
+  // more than the output, as if from a different input
+  std::vector<uint8_t> stale(data.size() + 4096, 0xAA);
+
+  // no checkpoint yet: starts over
+  auto out = temp_file(stale);
+  run(in, out, std::nullopt, UINT64_MAX);
+  if (!output_is(out, data)) {
+    std::cerr << "stale output left without a checkpoint\n";
+    return 1;
+  }
+  close(out);
+
+  // interrupted halfway, then the output is overwritten past the checkpoint
+  out = temp_file(stale);
+  lseek(in, 0, SEEK_SET);
+  auto checkpoint = run(in, out, std::nullopt, data.size() / 2);
+  if (pwrite(out, stale.data(), stale.size(), checkpoint.output_offset) !=
+      static_cast<ssize_t>(stale.size())) {
+    return 1;
+  }
+  run(in, out, checkpoint, UINT64_MAX);
+  if (!output_is(out, data)) {
+    std::cerr << "wrong output after resuming\n";
+    return 1;
+  }
+  close(out);
+
+  // the same size, but rewritten since
+  out = temp_file(stale);
+  lseek(in, 0, SEEK_SET);
+  checkpoint = run(in, out, std::nullopt, data.size() / 2);
+  auto mtime = checkpoint.input.mtime / 1000000000 + 1;
+  timespec times[2] = {{0, UTIME_OMIT}, {mtime, 0}};
+  if (futimens(in, times) != 0) return 1;
+  try {
+    seek_to(checkpoint, in, out);
+    std::cerr << "checkpoint resumed on another input\n";
+    return 1;
+  } catch (Error const &e) {
+    if (e.type() != ErrorType::InvalidCheckpoint) throw;
+  }
+  close(out);
+  close(in);
+  return 0;
+}
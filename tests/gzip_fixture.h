@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#ifdef USE_FAST_CRC32
+#include "Crc32.h"
+#else
+#include "zlib.h"
+#endif
+
+// builds gzip input in memory, so that the tests need no compressor nor
+// fixture files
+
+// LSB-first, as deflate packs everything but Huffman codes
+struct BitWriter {
+  std::vector<uint8_t> out;
+  uint32_t acc = 0;
+  int nbits = 0;
+
+  void put(uint32_t bits, int len) {
+    acc |= bits << nbits;
+    nbits += len;
+    while (nbits >= 8) {
+      out.push_back(acc & 0xff);
+      acc >>= 8;
+      nbits -= 8;
+    }
+  }
+
+  // Huffman codes are packed from their most significant bit on
+  void put_code(uint32_t code, int len) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < len; ++i) {
+      reversed |= ((code >> i) & 1) << (len - 1 - i);
+    }
+    put(reversed, len);
+  }
+
+  void align() {
+    if (nbits > 0) put(0, 8 - nbits);
+  }
+};
+
+// text-like bytes from a fixed seed, with both literal code lengths
+inline std::vector<uint8_t> sample_data(std::size_t size) {
+  std::vector<uint8_t> data(size);
+  uint32_t x = 2463534242;
+  for (auto &byte : data) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    byte = x % 8 == 0 ? 0x80 + x % 128 : 'a' + x % 26;
+  }
+  return data;
+}
+
+/**
+ * One gzip member holding data in blocks of block_size bytes: three stored
+ * blocks, then one fixed-Huffman block of literals, and so on.
+ */
+inline std::vector<uint8_t> gzip_member(std::vector<uint8_t> const &data,
+                                        std::size_t block_size = 65535) {
+  BitWriter writer;
+  writer.out = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 255};
+  std::size_t blocks = 0;
+  for (std::size_t i = 0; i < data.size() || blocks == 0; i += block_size) {
+    auto len = std::min(block_size, data.size() - i);
+    uint32_t final = i + len == data.size();
+    if (++blocks % 4 != 0) {
+      writer.put(final, 1);
+      writer.put(0, 2);
+      writer.align();
+      writer.put(len, 16);
+      writer.put(~len & 0xffff, 16);
+      writer.out.insert(writer.out.end(), data.begin() + i,
+                        data.begin() + i + len);
+      continue;
+    }
+    writer.put(final, 1);
+    writer.put(1, 2);
+    for (auto j = i; j < i + len; ++j) {
+      if (data[j] < 144) {
+        writer.put_code(0x30 + data[j], 8);
+      } else {
+        writer.put_code(0x190 + data[j] - 144, 9);
+      }
+    }
+    writer.put_code(0, 7);  // end of block
+  }
+  writer.align();
+#ifdef USE_FAST_CRC32
+  uint32_t crc = crc32_fast(data.data(), data.size());
+#else
+  uint32_t crc = crc32(0, data.data(), data.size());
+#endif
+  writer.put(crc & 0xffff, 16);
+  writer.put(crc >> 16, 16);
+  writer.put(data.size() & 0xffff, 16);
+  writer.put((data.size() >> 16) & 0xffff, 16);
+  return writer.out;
+}
@@ -0,0 +1,36 @@
+// -t --max-memory: the chunks in flight stay within the limit, give or take
+// the one item decoded before it is acquired
+
+#include <iostream>
+
+#include "decompressor.h"
+#include "gzip_fixture.h"
+#include "io.h"
+
+int main() {
+  // mostly stored blocks, which go out in the largest items
+  auto data = sample_data(16 << 20);
+  auto input = gzip_member(data);
+
+  constexpr std::size_t LIMIT = 2 << 20;
+  MemoryBudget budget{LIMIT};
+  MemoryReader reader{input.data(), input.data() + input.size()};
+  std::vector<uint8_t> output(data.size() + 1);
+  std::size_t n;
+  {
+    Decompressor decompressor{reader, true, &budget};
+    n = decompressor.read(Slice{output});
+  }
+
+  if (n != data.size() ||
+      !std::equal(data.begin(), data.end(), output.begin())) {
+    std::cerr << "wrong output\n";
+    return 1;
+  }
+  if (budget.peak() > LIMIT + MAX_STORED_RUN) {
+    std::cerr << "peak " << budget.peak() << " over limit " << LIMIT
+              << " plus one item\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,46 @@
+// -t: a decoding error on the producer thread is thrown by the consumer
+// after the output before it, and dropped if the consumer stops first
+
+#include <iostream>
+
+#include "decompressor.h"
+#include "gzip_fixture.h"
+#include "io.h"
+
+int main() {
+  auto data = sample_data(4 << 20);
+  auto input = gzip_member(data);
+  input.resize(input.size() / 2);
+
+  std::vector<uint8_t> output(data.size());
+  std::size_t n = 0;
+  auto thrown = false;
+  {
+    MemoryReader reader{input.data(), input.data() + input.size()};
+    Decompressor decompressor{reader, true};
+    try {
+      for (std::size_t len; (len = decompressor.read_some(
+                                 Slice{output.data() + n,
+                                       output.data() + output.size()})) > 0;) {
+        n += len;
+      }
+    } catch (Error const &e) {
+      thrown = e.type() == ErrorType::UnexpectedEof;
+    }
+  }
+  if (!thrown) {
+    std::cerr << "no UnexpectedEof from the producer thread\n";
+    return 1;
+  }
+  if (n == 0 || !std::equal(output.begin(), output.begin() + n, data.begin())) {
+    std::cerr << "wrong output before the error\n";
+    return 1;
+  }
+
+  {
+    MemoryReader reader{input.data(), input.data() + input.size()};
+    Decompressor decompressor{reader, true};
+    decompressor.read(Slice{output.data(), output.data() + 1});
+  }
+  return 0;
+}